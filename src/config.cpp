@@ -36,9 +36,37 @@ AppConfig AppConfig::load() {
 
         try {
             if (key == "max_connections") config.max_connections = std::stoi(value);
+            else if (key == "max_connections_per_host") config.max_connections_per_host = std::stoi(value);
+            else if (key == "max_total_connections") config.max_total_connections = std::stoi(value);
             else if (key == "max_downloads") config.max_downloads = std::stoi(value);
+            else if (key == "max_downloads_per_host") config.max_downloads_per_host = std::stoi(value);
+            else if (key == "scheduling") config.scheduling = value;
+            else if (key == "keep_finished") config.keep_finished = std::stoi(value);
             else if (key == "max_retries") config.max_retries = std::stoi(value);
+            else if (key == "stall_window") config.stall_window = std::stoi(value);
+            else if (key == "stall_min_speed") config.stall_min_speed = std::stoi(value);
+            else if (key == "hedge_budget_pct") config.hedge_budget_pct = std::stoi(value);
+            else if (key == "hedge_start_pct") config.hedge_start_pct = std::stoi(value);
+            else if (key == "hedge_max") config.hedge_max = std::stoi(value);
+            else if (key == "hedge_other_address") config.hedge_other_address = std::stoi(value) != 0;
+            else if (key == "probe_concurrency") config.probe_concurrency = std::stoi(value);
+            else if (key == "probe_ttl") config.probe_ttl = std::stoi(value);
+            else if (key == "transport") config.transport = value;
+            else if (key == "multiplex_connections") config.multiplex_connections = std::stoi(value);
+            else if (key == "native_http") config.native_http = std::stoi(value) != 0;
             else if (key == "output_dir") config.output_dir = value;
+            else if (key == "sync") config.sync = value;
+            else if (key == "sync_batch_mb") config.sync_batch_mb = std::stoi(value);
+            else if (key == "cache_mode") config.cache_mode = value;
+            else if (key == "cache_bypass_min_mb") config.cache_bypass_min_mb = std::stoi(value);
+            else if (key == "extract") config.extract = std::stoi(value) != 0;
+            else if (key == "extract_dir") config.extract_dir = value;
+            else if (key == "keep_archive") config.keep_archive = std::stoi(value) != 0;
+            else if (key == "log_level") config.log_level = value;
+            else if (key == "socket_path") config.socket_path = value;
+            else if (key == "metrics_port") config.metrics_port = std::stoi(value);
+            else if (key == "metrics_file") config.metrics_file = value;
+            else if (key == "metrics_interval") config.metrics_interval = std::stoi(value);
         } catch (const std::exception& e) {
             spdlog::warn("erro ao ler config '{}': {}", key, e.what());
         }
@@ -53,7 +81,39 @@ void AppConfig::save() const {
 
     file << "[download]" << std::endl;
     file << "max_connections=" << max_connections << std::endl;
+    file << "max_connections_per_host=" << max_connections_per_host << std::endl;
+    file << "max_total_connections=" << max_total_connections << std::endl;
     file << "max_downloads=" << max_downloads << std::endl;
+    file << "max_downloads_per_host=" << max_downloads_per_host << std::endl;
+    file << "scheduling=" << scheduling << std::endl;
+    file << "keep_finished=" << keep_finished << std::endl;
     file << "max_retries=" << max_retries << std::endl;
+    file << "stall_window=" << stall_window << std::endl;
+    file << "stall_min_speed=" << stall_min_speed << std::endl;
+    file << "hedge_budget_pct=" << hedge_budget_pct << std::endl;
+    file << "hedge_start_pct=" << hedge_start_pct << std::endl;
+    file << "hedge_max=" << hedge_max << std::endl;
+    file << "hedge_other_address=" << hedge_other_address << std::endl;
+    file << "probe_concurrency=" << probe_concurrency << std::endl;
+    file << "probe_ttl=" << probe_ttl << std::endl;
+    file << "transport=" << transport << std::endl;
+    file << "multiplex_connections=" << multiplex_connections << std::endl;
+    file << "native_http=" << native_http << std::endl;
     file << "output_dir=" << output_dir << std::endl;
+    file << "sync=" << sync << std::endl;
+    file << "sync_batch_mb=" << sync_batch_mb << std::endl;
+    file << "cache_mode=" << cache_mode << std::endl;
+    file << "cache_bypass_min_mb=" << cache_bypass_min_mb << std::endl;
+    file << "\n[extract]" << std::endl;
+    file << "extract=" << extract << std::endl;
+    file << "extract_dir=" << extract_dir << std::endl;
+    file << "keep_archive=" << keep_archive << std::endl;
+    file << "\n[log]" << std::endl;
+    file << "log_level=" << log_level << std::endl;
+    file << "\n[daemon]" << std::endl;
+    file << "socket_path=" << socket_path << std::endl;
+    file << "\n[metrics]" << std::endl;
+    file << "metrics_port=" << metrics_port << std::endl;
+    file << "metrics_file=" << metrics_file << std::endl;
+    file << "metrics_interval=" << metrics_interval << std::endl;
 }
@@ -0,0 +1,156 @@
+#include "connection_budget.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+ConnectionBudget::Lease &ConnectionBudget::Lease::operator=(Lease &&other) noexcept {
+    if (this != &other) {
+        release();
+        budget_ = other.budget_;
+        origin_ = std::move(other.origin_);
+        connections_ = other.connections_;
+        other.budget_ = nullptr;
+    }
+    return *this;
+}
+
+void ConnectionBudget::Lease::release() {
+    if (budget_) {
+        budget_->release(origin_, connections_);
+        budget_ = nullptr;
+    }
+}
+
+void ConnectionBudget::set_limits(int max_total, int max_per_origin) {
+    {
+        std::lock_guard lock(mutex_);
+        max_total_ = max_total;
+        max_per_origin_ = max_per_origin;
+    }
+    cv_.notify_all();
+}
+
+bool ConnectionBudget::slot_free(const OriginState &state) const {
+    const bool origin_free = max_per_origin_ <= 0 || state.in_use < max_per_origin_;
+    const bool total_free = max_total_ <= 0 || in_use_ < max_total_;
+    return origin_free && total_free;
+}
+
+ConnectionBudget::Turn ConnectionBudget::wait_turn(std::unique_lock<std::mutex> &lock, OriginState &state,
+                                                   const std::atomic<bool> *cancelled, bool shared) {
+    const uint64_t ticket = next_ticket_++;
+    state.waiters.push_back(ticket);
+    waiting_++;
+
+    auto leave = [&] {
+        state.waiters.erase(std::find(state.waiters.begin(), state.waiters.end(), ticket));
+        waiting_--;
+    };
+
+    while (true) {
+        if (state.waiters.front() == ticket && slot_free(state)) {
+            waiting_--;
+            state.waiters.pop_front();
+            state.in_use++;
+            in_use_++;
+            return Turn::SLOT;
+        }
+        if (shared && state.stream_slots > 0) {
+            leave();
+            return Turn::SHARED;
+        }
+        if (cancelled && cancelled->load()) {
+            leave();
+            return Turn::CANCELLED;
+        }
+        cv_.wait_for(lock, std::chrono::milliseconds(200));
+    }
+}
+
+ConnectionBudget::Lease ConnectionBudget::acquire(const std::string &origin,
+                                                  const std::atomic<bool> *cancelled) {
+    std::unique_lock lock(mutex_);
+    const Turn turn = wait_turn(lock, origins_[origin], cancelled, false);
+    if (turn == Turn::CANCELLED) forget_if_idle(origin);
+    lock.unlock();
+
+    // The next ticket on this origin may be admissible too
+    cv_.notify_all();
+    return turn == Turn::CANCELLED ? Lease() : Lease(this, origin);
+}
+
+ConnectionBudget::Lease ConnectionBudget::acquire_stream(const std::string &origin, int connections,
+                                                         const std::atomic<bool> *cancelled) {
+    connections = std::max(1, connections);
+    std::unique_lock lock(mutex_);
+    auto &state = origins_[origin];
+    state.streams++;
+
+    Turn turn = Turn::SHARED;
+    if (state.stream_slots == 0) {
+        turn = wait_turn(lock, state, cancelled, true);
+    } else if (state.stream_slots < std::min(state.streams, connections) && state.waiters.empty() &&
+               slot_free(state)) {
+        state.in_use++;
+        in_use_++;
+        turn = Turn::SLOT;
+    }
+
+    if (turn == Turn::SLOT) {
+        // Another stream may have got the first slot while this one waited
+        if (state.stream_slots < std::min(state.streams, connections)) {
+            state.stream_slots++;
+        } else {
+            state.in_use--;
+            in_use_--;
+        }
+    }
+    if (turn == Turn::CANCELLED) {
+        state.streams--;
+        forget_if_idle(origin);
+    }
+    lock.unlock();
+
+    cv_.notify_all();
+    return turn == Turn::CANCELLED ? Lease() : Lease(this, origin, connections);
+}
+
+int ConnectionBudget::idle_connections() const {
+    std::lock_guard lock(mutex_);
+    if (max_total_ <= 0) return std::numeric_limits<int>::max();
+    return std::max(0, max_total_ - in_use_ - waiting_);
+}
+
+int ConnectionBudget::per_origin_limit() const {
+    std::lock_guard lock(mutex_);
+    return std::max(0, max_per_origin_);
+}
+
+void ConnectionBudget::forget_if_idle(const std::string &origin) {
+    auto it = origins_.find(origin);
+    if (it == origins_.end()) return;
+    const OriginState &state = it->second;
+    if (state.in_use == 0 && state.waiters.empty() && state.streams == 0) origins_.erase(it);
+}
+
+void ConnectionBudget::release(const std::string &origin, int connections) {
+    {
+        std::lock_guard lock(mutex_);
+        auto it = origins_.find(origin);
+        if (it == origins_.end()) return;
+        OriginState &state = it->second;
+
+        int freed = 1;
+        if (connections > 0) {
+            // Remaining streams keep as many connections as they can fill
+            state.streams--;
+            const int keep = std::min(state.streams, connections);
+            freed = std::max(0, state.stream_slots - keep);
+            state.stream_slots -= freed;
+        }
+        state.in_use -= freed;
+        in_use_ -= freed;
+        forget_if_idle(origin);
+    }
+    cv_.notify_all();
+}
@@ -0,0 +1,496 @@
+#include "control.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <poll.h>
+#include <sstream>
+#include <unordered_set>
+#include <spdlog/spdlog.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace control {
+
+std::string default_socket_path() {
+    if (const char* runtime = std::getenv("XDG_RUNTIME_DIR"); runtime && *runtime) {
+        return std::string(runtime) + "/cdownload.sock";
+    }
+    return "/tmp/cdownload-" + std::to_string(getuid()) + ".sock";
+}
+
+std::vector<std::string> split(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        const size_t tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab - start));
+        if (tab == std::string::npos) break;
+        start = tab + 1;
+    }
+    return fields;
+}
+
+// Fields travel tab-separated, one record per line
+std::string field(const std::string& value) {
+    std::string out = value;
+    for (char& c : out) {
+        if (c == '\t' || c == '\n' || c == '\r') c = ' ';
+    }
+    return out;
+}
+
+std::string encode_entry(const DownloadEntry& entry) {
+    std::ostringstream os;
+    os << "E\t" << entry.id << '\t' << entry.version << '\t' << static_cast<int>(entry.status) << '\t'
+       << static_cast<int>(entry.priority) << '\t' << entry.bytes_downloaded << '\t' << entry.content_size
+       << '\t' << entry.elapsed_seconds << '\t' << (entry.accept_ranges ? 1 : 0) << '\t'
+       << field(entry.url) << '\t' << field(entry.output_dir) << '\t' << field(entry.filename) << '\t'
+       << field(entry.output_path) << '\n';
+    for (const auto& [tid, ts] : entry.threads) {
+        os << "T\t" << entry.id << '\t' << tid << '\t' << static_cast<int>(ts.status) << '\t'
+           << ts.bytes_downloaded << '\t' << ts.total_bytes << '\t' << ts.elapsed_seconds << '\t'
+           << ts.retries << '\n';
+    }
+    std::string out = os.str();
+    out.pop_back();
+    return out;
+}
+
+int apply_line(const std::string& line, DownloadService::Entries& entries,
+               std::unordered_map<int, DownloadEntry*>& by_id) {
+    const auto f = split(line);
+    try {
+        if (f[0] == "E" && f.size() == 13) {
+            const int id = std::stoi(f[1]);
+            DownloadEntry* entry = nullptr;
+            if (auto it = by_id.find(id); it != by_id.end()) {
+                entry = it->second;
+            } else {
+                auto created = std::make_unique<DownloadEntry>();
+                created->id = id;
+                entry = created.get();
+                by_id[id] = entry;
+                entries.push_back(std::move(created));
+            }
+            entry->version = std::stoull(f[2]);
+            entry->status = static_cast<DownloadStatus>(std::stoi(f[3]));
+            entry->priority = static_cast<DownloadPriority>(std::stoi(f[4]));
+            entry->bytes_downloaded = std::stoull(f[5]);
+            entry->content_size = std::stoull(f[6]);
+            entry->elapsed_seconds = std::stod(f[7]);
+            entry->accept_ranges = f[8] == "1";
+            entry->url = f[9];
+            entry->output_dir = f[10];
+            entry->filename = f[11];
+            entry->output_path = f[12];
+            // T lines for this entry follow
+            entry->threads.clear();
+            return id;
+        }
+        if (f[0] == "R" && f.size() == 2) {
+            const int id = std::stoi(f[1]);
+            if (!by_id.erase(id)) return -1;
+            std::erase_if(entries, [id](const auto& e) { return e->id == id; });
+            return id;
+        }
+        if (f[0] == "T" && f.size() == 8) {
+            const int id = std::stoi(f[1]);
+            auto it = by_id.find(id);
+            if (it == by_id.end()) return -1;
+            auto& ts = it->second->threads[std::stoi(f[2])];
+            ts.status = static_cast<DownloadStatus>(std::stoi(f[3]));
+            ts.bytes_downloaded = std::stoull(f[4]);
+            ts.total_bytes = std::stoull(f[5]);
+            ts.elapsed_seconds = std::stod(f[6]);
+            ts.retries = std::stoi(f[7]);
+            return id;
+        }
+    } catch (const std::exception& e) {
+        spdlog::warn("control: linha invalida '{}': {}", line, e.what());
+    }
+    return -1;
+}
+
+LineSocket& LineSocket::operator=(LineSocket&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd_ = other.fd_;
+        buffer_ = std::move(other.buffer_);
+        other.fd_ = -1;
+    }
+    return *this;
+}
+
+LineSocket LineSocket::connect(const std::string& path) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return {};
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        ::close(fd);
+        return {};
+    }
+    path.copy(addr.sun_path, path.size());
+
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        ::close(fd);
+        return {};
+    }
+    return LineSocket(fd);
+}
+
+void LineSocket::close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+}
+
+std::optional<std::string> LineSocket::read_line(int timeout_ms) {
+    while (true) {
+        if (const size_t nl = buffer_.find('\n'); nl != std::string::npos) {
+            std::string line = buffer_.substr(0, nl);
+            buffer_.erase(0, nl + 1);
+            return line;
+        }
+        if (fd_ < 0) return std::nullopt;
+
+        pollfd pfd{fd_, POLLIN, 0};
+        const int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) return std::nullopt;
+
+        char chunk[4096];
+        const ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close();
+            return std::nullopt;
+        }
+        buffer_.append(chunk, static_cast<size_t>(n));
+    }
+}
+
+bool LineSocket::write_line(const std::string& line) {
+    if (fd_ < 0) return false;
+    const std::string data = line + "\n";
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t n = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace control
+
+using control::LineSocket;
+
+static bool parse_priority(const std::string& value, DownloadPriority& out) {
+    if (value == "0" || value == "high") out = PRIORITY_HIGH;
+    else if (value == "1" || value == "normal") out = PRIORITY_NORMAL;
+    else if (value == "2" || value == "low") out = PRIORITY_LOW;
+    else return false;
+    return true;
+}
+
+ControlServer::~ControlServer() {
+    if (listen_fd_ >= 0) {
+        ::close(listen_fd_);
+        unlink(path_.c_str());
+    }
+}
+
+bool ControlServer::listen() {
+    // A socket file nobody answers on is left over from a crashed daemon
+    if (LineSocket::connect(path_).is_open()) {
+        spdlog::error("daemon: ja existe um daemon em {}", path_);
+        return false;
+    }
+    unlink(path_.c_str());
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (listen_fd_ < 0 || path_.size() >= sizeof(addr.sun_path)) {
+        spdlog::error("daemon: caminho de socket invalido: {}", path_);
+        return false;
+    }
+    path_.copy(addr.sun_path, path_.size());
+
+    const mode_t old_mask = umask(077);
+    const bool bound = bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    umask(old_mask);
+
+    if (!bound || ::listen(listen_fd_, 64) < 0) {
+        spdlog::error("daemon: falha ao escutar em {}", path_);
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+
+    spdlog::info("daemon: escutando em {}", path_);
+    return true;
+}
+
+void ControlServer::run(const std::atomic<bool>& stop) {
+    while (!stop && !shutdown_) {
+        pollfd pfd{listen_fd_, POLLIN, 0};
+        if (poll(&pfd, 1, 250) <= 0 || !(pfd.revents & POLLIN)) continue;
+
+        const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+
+        std::lock_guard lock(clients_mutex_);
+        // Short-lived CLI clients come and go all the time; join the ones
+        // that already hung up.
+        for (const uint64_t done : finished_clients_) {
+            if (auto it = client_threads_.find(done); it != client_threads_.end()) {
+                it->second.join();
+                client_threads_.erase(it);
+            }
+        }
+        finished_clients_.clear();
+
+        const uint64_t client = next_client_++;
+        client_fds_.push_back(fd);
+        client_threads_.emplace(client, std::thread([this, client, fd] { serve(client, LineSocket(fd)); }));
+    }
+
+    // Wake clients blocked in read_line or streaming
+    {
+        std::lock_guard lock(clients_mutex_);
+        for (const int fd : client_fds_) {
+            ::shutdown(fd, SHUT_RDWR);
+        }
+    }
+    for (auto& [client, t] : client_threads_) {
+        if (t.joinable()) t.join();
+    }
+    client_threads_.clear();
+    finished_clients_.clear();
+    client_fds_.clear();
+}
+
+void ControlServer::serve(uint64_t client, LineSocket socket) {
+    const int fd = socket.fd();
+
+    while (!shutdown_) {
+        const auto line = socket.read_line();
+        if (!line) break;
+        if (line->empty()) continue;
+
+        const auto args = control::split(*line);
+        if (args[0] == "watch") {
+            stream(socket);
+            break;
+        }
+        if (args[0] == "list") {
+            list(socket);
+            continue;
+        }
+        if (!socket.write_line(handle(args))) break;
+    }
+
+    std::lock_guard lock(clients_mutex_);
+    std::erase(client_fds_, fd);
+    finished_clients_.push_back(client);
+}
+
+std::string ControlServer::handle(const std::vector<std::string>& args) {
+    const std::string& cmd = args[0];
+    try {
+        if (cmd == "enqueue" && args.size() == 4) {
+            DownloadPriority priority;
+            if (!parse_priority(args[3], priority)) return "err\tprioridade invalida";
+            const int id = service_.enqueue(args[1], args[2], priority);
+            return id < 0 ? "err\tnao aceito" : "ok\t" + std::to_string(id);
+        }
+        if (cmd == "priority" && args.size() == 3) {
+            DownloadPriority priority;
+            if (!parse_priority(args[2], priority)) return "err\tprioridade invalida";
+            return service_.set_priority(std::stoi(args[1]), priority) ? "ok" : "err\tnao pendente";
+        }
+        if ((cmd == "pause" || cmd == "resume" || cmd == "cancel") && args.size() == 2) {
+            const int id = std::stoi(args[1]);
+            bool done = cmd == "pause" ? service_.pause(id)
+                      : cmd == "resume" ? service_.resume(id)
+                      : service_.cancel(id);
+            return done ? "ok" : "err\testado invalido para " + cmd;
+        }
+        if (cmd == "limits" && args.size() == 4) {
+            std::lock_guard lock(config_mutex_);
+            config_.max_connections = std::stoi(args[1]);
+            config_.max_downloads = std::stoi(args[2]);
+            config_.max_retries = std::stoi(args[3]);
+            service_.apply_config(config_);
+            return "ok";
+        }
+        if (cmd == "shutdown") {
+            shutdown_ = true;
+            return "ok";
+        }
+    } catch (const std::exception& e) {
+        return std::string("err\t") + e.what();
+    }
+    return "err\tcomando desconhecido: " + cmd;
+}
+
+void ControlServer::list(LineSocket& socket) {
+    std::string out;
+    service_.read([&](const DownloadService::Entries& entries) {
+        for (const auto& e : entries) {
+            out += control::encode_entry(*e);
+            out += '\n';
+        }
+    });
+    out += "end";
+    socket.write_line(out);
+}
+
+// Pushes every entry whose version moved since the last batch, four times a
+// second, until the client goes away.
+void ControlServer::stream(LineSocket& socket) {
+    uint64_t seen = 0;
+    bool first = true;
+    std::unordered_set<int> sent; // ids the client mirrors
+
+    while (!shutdown_ && socket.is_open()) {
+        std::string out;
+        uint64_t newest = seen;
+        service_.read([&](const DownloadService::Entries& entries) {
+            for (const auto& e : entries) {
+                if (e->version <= seen) continue;
+                newest = std::max(newest, e->version);
+                sent.insert(e->id);
+                out += control::encode_entry(*e);
+                out += '\n';
+            }
+            // Ids are never reused, so fewer entries than sent ids means
+            // the service pruned some since the last batch
+            if (entries.size() >= sent.size()) return;
+            std::unordered_set<int> present;
+            for (const auto& e : entries) present.insert(e->id);
+            for (auto it = sent.begin(); it != sent.end();) {
+                if (present.count(*it)) {
+                    ++it;
+                    continue;
+                }
+                out += "R\t" + std::to_string(*it) + '\n';
+                it = sent.erase(it);
+            }
+        });
+        seen = newest;
+
+        if (first || !out.empty()) {
+            first = false;
+            if (!socket.write_line(out + "end")) break;
+        }
+
+        // Doubles as the tick and as disconnect detection
+        if (socket.read_line(250)) continue;
+    }
+}
+
+DaemonClient::~DaemonClient() {
+    watching_ = false;
+    if (watch_thread_.joinable()) watch_thread_.join();
+}
+
+bool DaemonClient::connect() {
+    std::lock_guard lock(command_mutex_);
+    command_ = LineSocket::connect(path_);
+    return command_.is_open();
+}
+
+void DaemonClient::watch() {
+    LineSocket socket = LineSocket::connect(path_);
+    if (!socket.is_open() || !socket.write_line("watch")) {
+        spdlog::error("daemon: falha ao acompanhar {}", path_);
+        return;
+    }
+
+    watching_ = true;
+    // The socket never leaves this thread, which closes it on EOF: waking
+    // the read from outside could hit a reused fd number. Instead the read
+    // times out, like the server's stream, to notice `watching_` dropping.
+    watch_thread_ = std::thread([this, socket = std::move(socket)]() mutable {
+        while (watching_) {
+            const auto line = socket.read_line(250);
+            if (!line) {
+                if (socket.is_open()) continue;
+                break;
+            }
+
+            std::lock_guard lock(mirror_mutex_);
+            if (*line == "end") {
+                if (on_change_) on_change_();
+                continue;
+            }
+            control::apply_line(*line, mirror_, mirror_by_id_);
+        }
+    });
+}
+
+std::vector<std::string> DaemonClient::request(const std::string& line) {
+    std::lock_guard lock(command_mutex_);
+    std::vector<std::string> reply;
+    if (!command_.write_line(line)) return reply;
+
+    const bool multi = line == "list";
+    while (auto response = command_.read_line()) {
+        if (multi && *response == "end") break;
+        reply.push_back(*response);
+        if (!multi) break;
+    }
+    return reply;
+}
+
+bool DaemonClient::simple(const std::string& line) {
+    const auto reply = request(line);
+    return !reply.empty() && reply[0].rfind("ok", 0) == 0;
+}
+
+int DaemonClient::enqueue(const std::string& url, const std::string& output_dir,
+                          DownloadPriority priority) {
+    const auto reply = request("enqueue\t" + control::field(url) + "\t" + control::field(output_dir) +
+                               "\t" + std::to_string(static_cast<int>(priority)));
+    if (reply.empty() || reply[0].rfind("ok\t", 0) != 0) return -1;
+    return std::stoi(reply[0].substr(3));
+}
+
+bool DaemonClient::set_priority(int id, DownloadPriority priority) {
+    return simple("priority\t" + std::to_string(id) + "\t" + std::to_string(static_cast<int>(priority)));
+}
+
+bool DaemonClient::pause(int id) {
+    return simple("pause\t" + std::to_string(id));
+}
+
+bool DaemonClient::resume(int id) {
+    return simple("resume\t" + std::to_string(id));
+}
+
+bool DaemonClient::cancel(int id) {
+    return simple("cancel\t" + std::to_string(id));
+}
+
+// Only the limits the TUI can edit travel; the daemon keeps its own
+// config.ini for everything else.
+void DaemonClient::apply_config(const AppConfig& config) {
+    simple("limits\t" + std::to_string(config.max_connections) + "\t" +
+           std::to_string(config.max_downloads) + "\t" + std::to_string(config.max_retries));
+}
+
+void DaemonClient::read(const std::function<void(const Entries&)>& fn) {
+    std::lock_guard lock(mirror_mutex_);
+    fn(mirror_);
+}
+
+void DaemonClient::set_on_change(std::function<void()> callback) {
+    std::lock_guard lock(mirror_mutex_);
+    on_change_ = std::move(callback);
+}
@@ -1,22 +1,178 @@
 #include "download_manager.h"
 #include "config.h"
+#include "constants.h"
+#include "control.h"
+#include "engine.h"
+#include "trace.h"
 #include "ui.h"
+#include "utils.h"
 #include <argparse/argparse.hpp>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <spdlog/spdlog.h>
+#include <spdlog/async.h>
 #include <spdlog/sinks/rotating_file_sink.h>
 
 namespace fs = std::filesystem;
 
 DownloadManager::DownloadManager() = default;
 
-int DownloadManager::run(int argc, char *argv[]) {
-    auto logger = spdlog::rotating_logger_mt("app", "cdownload.log", 5 * 1024 * 1024, 2);
+// Records are handed to a single background thread through a bounded queue;
+// when it is full the oldest record is dropped rather than blocking the
+// calling (network) thread.
+static void init_logging() {
+    spdlog::init_thread_pool(constants::LOG_QUEUE_SIZE, 1);
+    auto sink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
+        "cdownload.log", 5 * 1024 * 1024, 2);
+    auto logger = std::make_shared<spdlog::async_logger>(
+        "app", sink, spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
+    logger->flush_on(spdlog::level::err);
     spdlog::set_default_logger(logger);
-    spdlog::set_level(spdlog::level::debug);
+    spdlog::set_level(spdlog::level::info);
+}
+
+// spdlog::level::from_str maps any unknown name to off, so a typo would
+// silently disable logging
+static spdlog::level::level_enum parse_log_level(const std::string &name) {
+    const auto level = spdlog::level::from_str(name);
+    if (level != spdlog::level::off || name == "off") return level;
+    spdlog::warn("nivel de log desconhecido '{}', usando info", name);
+    return spdlog::level::info;
+}
+
+static int run_app(int argc, char *argv[]);
+
+static std::atomic<bool> stop_requested{false};
+
+static int run_daemon(const AppConfig &config, const std::string &socket_path) {
+    DownloadEngine engine(config);
+    ControlServer server(engine, config, socket_path);
+    if (!server.listen()) {
+        std::cerr << "falha ao abrir o socket " << socket_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::signal(SIGINT, [](int) { stop_requested = true; });
+    std::signal(SIGTERM, [](int) { stop_requested = true; });
+    std::signal(SIGPIPE, SIG_IGN);
+
+    engine.start();
+    spdlog::info("daemon iniciado: socket={}", socket_path);
+    server.run(stop_requested);
+
+    spdlog::info("daemon encerrando");
+    engine.shutdown(true);
+    return EXIT_SUCCESS;
+}
+
+static void print_entry(const DownloadEntry &e) {
+    const int percent = e.content_size > 0
+        ? static_cast<int>(100.0 * static_cast<double>(e.bytes_downloaded) /
+                           static_cast<double>(e.content_size))
+        : 0;
+    std::cout << e.id << '\t' << e.status << '\t' << percent << "%\t" << e.bytes_downloaded << '/'
+              << e.content_size << '\t' << (e.filename.empty() ? e.url : e.filename) << std::endl;
+}
+
+static int run_client(const argparse::ArgumentParser &program, const std::string &socket_path,
+                      const std::string &output_dir) {
+    DaemonClient client(socket_path);
+    if (!client.connect()) {
+        std::cerr << "daemon indisponivel em " << socket_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const auto priority_name = program.get<std::string>("--priority");
+    DownloadPriority priority = PRIORITY_NORMAL;
+    if (priority_name == "high") priority = PRIORITY_HIGH;
+    else if (priority_name == "low") priority = PRIORITY_LOW;
+
+    int rc = EXIT_SUCCESS;
+    auto submit = [&](const std::string &url) {
+        if (url.empty() || url[0] == '#') return;
+        const int id = client.enqueue(url, output_dir, priority);
+        if (id < 0) {
+            std::cerr << "recusado: " << url << std::endl;
+            rc = EXIT_FAILURE;
+            return;
+        }
+        std::cout << id << '\t' << url << std::endl;
+    };
+
+    if (program.is_used("--enqueue")) {
+        for (const auto &url : program.get<std::vector<std::string>>("--enqueue")) submit(url);
+    }
+    if (const auto file = program.get<std::string>("--enqueue-file"); !file.empty()) {
+        std::ifstream in;
+        if (file != "-") in.open(file);
+        std::istream &source = file == "-" ? std::cin : in;
+        std::string line;
+        while (std::getline(source, line)) submit(line);
+    }
+
+    auto command = [&](const char *name, bool (DaemonClient::*fn)(int)) {
+        if (const auto id = program.present<int>(name)) {
+            if (!(client.*fn)(*id)) {
+                std::cerr << name << " " << *id << ": recusado" << std::endl;
+                rc = EXIT_FAILURE;
+            }
+        }
+    };
+    command("--pause", &DaemonClient::pause);
+    command("--resume", &DaemonClient::resume);
+    command("--cancel", &DaemonClient::cancel);
+
+    if (program.get<bool>("--list")) {
+        DownloadService::Entries entries;
+        std::unordered_map<int, DownloadEntry *> by_id;
+        for (const auto &line : client.request("list")) control::apply_line(line, entries, by_id);
+        for (const auto &e : entries) print_entry(*e);
+    }
+
+    if (program.get<bool>("--watch")) {
+        std::signal(SIGINT, [](int) { stop_requested = true; });
+        // Print an entry again only when its version moved since the last pass
+        std::unordered_map<int, uint64_t> printed;
+        client.watch();
+        while (!stop_requested) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            client.read([&](const DownloadService::Entries &entries) {
+                for (const auto &e : entries) {
+                    auto [it, inserted] = printed.try_emplace(e->id, e->version);
+                    if (!inserted && it->second == e->version) continue;
+                    it->second = e->version;
+                    print_entry(*e);
+                }
+            });
+        }
+    }
+
+    if (program.get<bool>("--shutdown") && !client.request("shutdown").empty()) {
+        std::cout << "daemon encerrando" << std::endl;
+    }
+
+    return rc;
+}
+
+int DownloadManager::run(int argc, char *argv[]) {
+    init_logging();
+    const int rc = run_app(argc, argv);
+    spdlog::shutdown();
+    return rc;
+}
+
+static int run_app(int argc, char *argv[]) {
     spdlog::info("cdownload-manager iniciado");
 
     argparse::ArgumentParser program("app");
@@ -28,6 +184,48 @@ int DownloadManager::run(int argc, char *argv[]) {
     program.add_argument("--output")
         .help("pasta de destino do download")
         .default_value(std::string("."));
+    program.add_argument("--log-level")
+        .help("nivel de log: trace, debug, info, warn, error, off (padrao: config)")
+        .default_value(std::string(""));
+
+    program.add_argument("--extract")
+        .help("extrai .tar.gz/.tar.zst/.tar.xz/.gz/.zst/.xz enquanto baixa")
+        .flag();
+
+    program.add_argument("--trace")
+        .help("grava um trace dos downloads (Chrome trace / Perfetto) neste arquivo ao sair")
+        .default_value(std::string(""));
+
+    program.add_argument("--daemon")
+        .help("roda o motor de downloads em segundo plano, controlado via socket")
+        .flag();
+    program.add_argument("--socket")
+        .help("caminho do socket do daemon (padrao: config ou $XDG_RUNTIME_DIR/cdownload.sock)")
+        .default_value(std::string(""));
+    program.add_argument("--connect")
+        .help("abre a interface conectada ao daemon")
+        .flag();
+    program.add_argument("--enqueue")
+        .help("envia uma url ao daemon (repetivel)")
+        .append();
+    program.add_argument("--enqueue-file")
+        .help("envia ao daemon uma url por linha do arquivo ('-' para stdin)")
+        .default_value(std::string(""));
+    program.add_argument("--priority")
+        .help("prioridade dos downloads enviados: high, normal, low")
+        .default_value(std::string("normal"));
+    program.add_argument("--list")
+        .help("lista os downloads do daemon")
+        .flag();
+    program.add_argument("--watch")
+        .help("acompanha o progresso dos downloads do daemon")
+        .flag();
+    program.add_argument("--pause").help("pausa o download <id> no daemon").scan<'i', int>();
+    program.add_argument("--resume").help("retoma o download <id> no daemon").scan<'i', int>();
+    program.add_argument("--cancel").help("cancela o download <id> no daemon").scan<'i', int>();
+    program.add_argument("--shutdown")
+        .help("encerra o daemon")
+        .flag();
 
     try {
         program.parse_args(argc, argv);
@@ -37,9 +235,21 @@ int DownloadManager::run(int argc, char *argv[]) {
         return 1;
     }
 
+    AppConfig config = AppConfig::load();
+    if (program.get<bool>("--extract")) config.extract = true;
+
+    auto log_level = program.get<std::string>("--log-level");
+    if (log_level.empty()) log_level = config.log_level;
+    spdlog::set_level(parse_log_level(log_level));
+
     const auto url = program.get<std::string>("--url");
     const auto header_only = program.get<bool>("--header");
-    spdlog::info("args: url={}, header_only={}", url, header_only);
+    spdlog::info("args: url={}, header_only={}, log_level={}", url, header_only, log_level);
+
+    std::optional<trace::Recording> recording;
+    if (const auto trace_file = program.get<std::string>("--trace"); !trace_file.empty()) {
+        recording.emplace(trace_file);
+    }
 
     if (header_only && !url.empty()) {
         PreDownloadInfo::check_info(url, true);
@@ -53,16 +263,47 @@ int DownloadManager::run(int argc, char *argv[]) {
         output_dir = ".";
     }
 
-    const AppConfig config = AppConfig::load();
-    AppUI ui(config);
-    ui.run(url, output_dir);
+    std::string socket_path = program.get<std::string>("--socket");
+    if (socket_path.empty()) socket_path = config.socket_path;
+    if (socket_path.empty()) socket_path = control::default_socket_path();
+
+    if (program.get<bool>("--daemon")) {
+        return run_daemon(config, socket_path);
+    }
+
+    const bool client_command =
+        program.is_used("--enqueue") || !program.get<std::string>("--enqueue-file").empty() ||
+        program.get<bool>("--list") || program.get<bool>("--watch") || program.is_used("--pause") ||
+        program.is_used("--resume") || program.is_used("--cancel") || program.get<bool>("--shutdown");
+    if (client_command) {
+        return run_client(program, socket_path, fs::absolute(output_dir).string());
+    }
+
+    if (program.get<bool>("--connect")) {
+        DaemonClient client(socket_path);
+        if (!client.connect()) {
+            std::cerr << "daemon indisponivel em " << socket_path << std::endl;
+            return EXIT_FAILURE;
+        }
+        client.watch();
+        AppUI ui(config, client);
+        ui.run(url, fs::absolute(output_dir).string());
+        return EXIT_SUCCESS;
+    }
+
+    DownloadEngine engine(config);
+    engine.start();
+    {
+        AppUI ui(config, engine);
+        ui.run(url, output_dir);
+    }
+    engine.shutdown();
 
     return EXIT_SUCCESS;
 }
 
 bool DownloadManager::should_split(const size_t size, const bool accept_ranges) {
-    constexpr size_t MIN_SPLIT_SIZE = 5 * 1024 * 1024; // 5MB
-    return accept_ranges && size >= MIN_SPLIT_SIZE;
+    return download_manager::utils::should_split(size, accept_ranges);
 }
 
 DownloadManager::~DownloadManager() = default;
@@ -1,28 +1,227 @@
 #include "downloader.h"
+#include "multiplexer.h"
+#include "native_http.h"
 #include "structs.h"
+#include "trace.h"
 #include "utils.h"
+#include "write_back.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
 #include <chrono>
 #include <cpr/api.h>
 #include <cpr/cprtypes.h>
+#include <cpr/session.h>
 #include <cstddef>
+#include <curl/curl.h>
 #include <fcntl.h>
-#include <fstream>
+#include <functional>
 #include <future>
 #include <iostream>
+#include <mutex>
+#include <netdb.h>
+#include <optional>
 #include <spdlog/spdlog.h>
 #include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
 
 using namespace download_manager::utils;
 
+namespace {
+
+// One libcurl share handle for the whole process: DNS answers, TLS sessions
+// and idle keep-alive connections outlive the request that opened them, so
+// later segments and downloads to the same origin start warm. Transfers on a
+// Multiplexer keep their connections in its multi handle instead, where
+// they can carry several streams.
+class SharedCurlCache {
+  CURLSH *share_;
+  std::mutex locks_[CURL_LOCK_DATA_LAST];
+
+  static void lock(CURL *, curl_lock_data data, curl_lock_access, void *self) {
+    static_cast<SharedCurlCache *>(self)->locks_[data].lock();
+  }
+  static void unlock(CURL *, curl_lock_data data, void *self) {
+    static_cast<SharedCurlCache *>(self)->locks_[data].unlock();
+  }
+
+public:
+  explicit SharedCurlCache(bool connections) : share_(curl_share_init()) {
+    curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &SharedCurlCache::lock);
+    curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &SharedCurlCache::unlock);
+    curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    if (connections)
+      curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  }
+  ~SharedCurlCache() { curl_share_cleanup(share_); }
+
+  void attach(cpr::Session &session) {
+    curl_easy_setopt(session.GetCurlHolder()->handle, CURLOPT_SHARE, share_);
+  }
+};
+
+void use_shared_cache(cpr::Session &session, bool connections = true) {
+  static SharedCurlCache cache(true);
+  static SharedCurlCache without_connections(false);
+  (connections ? cache : without_connections).attach(session);
+}
+
+// Splits a finished request into libcurl's phase timings; `started` is when
+// the transfer was handed to libcurl. A reused connection has no resolve,
+// connect or TLS phase.
+void trace_phases(cpr::Session &session, uint64_t started, size_t bytes) {
+  if (!trace::enabled())
+    return;
+  CURL *handle = session.GetCurlHolder()->handle;
+  curl_off_t resolve = 0, connect = 0, tls = 0, pretransfer = 0,
+             first_byte = 0, total = 0;
+  curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &resolve);
+  curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &tls);
+  curl_easy_getinfo(handle, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+  curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+  curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total);
+
+  auto at = [started](curl_off_t micros) {
+    return started + static_cast<uint64_t>(micros) * 1000;
+  };
+  if (resolve > 0)
+    trace::complete("resolve", "net", started, at(resolve));
+  if (connect > resolve)
+    trace::complete("connect", "net", at(resolve), at(connect));
+  if (tls > connect)
+    trace::complete("tls", "net", at(connect), at(tls));
+  if (first_byte > pretransfer)
+    trace::complete("first byte", "net", at(pretransfer), at(first_byte));
+  if (total > first_byte)
+    trace::complete("transfer", "net", at(first_byte), at(total),
+                    static_cast<int64_t>(bytes), "bytes");
+}
+
+// Traces a request's consecutive writes as one "write" span per SPAN_BYTES.
+// A span per write callback (~16 KB) would fill the thread's ring within a
+// few hundred MB and push out the connect phases and retries it should keep.
+// Must stay on one thread, like the ring it records into.
+class WriteTrace {
+  static constexpr size_t SPAN_BYTES = 8 * 1024 * 1024;
+
+  uint64_t begin_ = 0;
+  uint64_t end_ = 0;
+  size_t bytes_ = 0;
+
+public:
+  WriteTrace() = default;
+  WriteTrace(const WriteTrace &) = delete;
+  WriteTrace &operator=(const WriteTrace &) = delete;
+  ~WriteTrace() { flush(); }
+
+  // Timestamp to pass to done() once the write returns; 0 while off
+  uint64_t start() const { return trace::enabled() ? trace::now() : 0; }
+
+  void done(uint64_t began, size_t n) {
+    if (began == 0)
+      return;
+    if (bytes_ == 0)
+      begin_ = began;
+    end_ = trace::now();
+    bytes_ += n;
+    if (bytes_ >= SPAN_BYTES)
+      flush();
+  }
+
+  void flush() {
+    if (bytes_ > 0 && trace::enabled())
+      trace::complete("write", "disk", begin_, end_,
+                      static_cast<int64_t>(bytes_), "bytes");
+    bytes_ = 0;
+  }
+};
+
+// The file's second descriptor for `mode`: O_DIRECT for DIRECT, else -1.
+// Falls back to DONTNEED where the filesystem refuses O_DIRECT.
+int open_for_cache_mode(const std::string &path, CacheMode &mode) {
+  if (mode != CacheMode::DIRECT)
+    return -1;
+  const int fd = open_direct(path);
+  if (fd < 0) {
+    spdlog::warn("O_DIRECT indisponivel para {}: usando fadvise", path);
+    mode = CacheMode::DONTNEED;
+  }
+  return fd;
+}
+
+// CURLOPT_CONNECT_TO entry for an address of `url`'s host other than
+// `avoid`; empty when the name resolves to nothing else
+std::string alternate_address(const std::string &url, const std::string &avoid) {
+  if (avoid.empty())
+    return {};
+  std::string host;
+  if (CURLU *parsed = curl_url()) {
+    char *part = nullptr;
+    if (curl_url_set(parsed, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK &&
+        curl_url_get(parsed, CURLUPART_HOST, &part, 0) == CURLUE_OK)
+      host = part;
+    curl_free(part);
+    curl_url_cleanup(parsed);
+  }
+  // An address literal has nowhere else to go
+  if (host.empty() || host.front() == '[')
+    return {};
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *found = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &found) != 0)
+    return {};
+
+  std::string entry;
+  for (const addrinfo *a = found; a && entry.empty(); a = a->ai_next) {
+    const void *addr = nullptr;
+    if (a->ai_family == AF_INET)
+      addr = &reinterpret_cast<const sockaddr_in *>(a->ai_addr)->sin_addr;
+    else if (a->ai_family == AF_INET6)
+      addr = &reinterpret_cast<const sockaddr_in6 *>(a->ai_addr)->sin6_addr;
+    char text[INET6_ADDRSTRLEN];
+    if (!addr || !inet_ntop(a->ai_family, addr, text, sizeof(text)) ||
+        avoid == text)
+      continue;
+    // "::<addr>:" keeps the URL's host (Host header, SNI) and port
+    entry = a->ai_family == AF_INET6 ? "::[" + std::string(text) + "]:"
+                                     : "::" + std::string(text) + ":";
+  }
+  freeaddrinfo(found);
+  return entry;
+}
+
+} // namespace
+
 PreDownloadInfo PreDownloadInfo::check_info(const std::string &url,
                                             const bool &header_only) {
   PreDownloadInfo info{false, 0, url, ""};
 
   spdlog::info("HEAD request: {}", url);
+  trace::Span span("probe", "download");
 
   try {
-    const auto response =
-        cpr::Head(cpr::Url{url}, cpr::Header{{"Accept-Encoding", "identity"}});
+    cpr::Session session;
+    session.SetUrl(cpr::Url{url});
+    session.SetHeader(cpr::Header{{"Accept-Encoding", "identity"}});
+    use_shared_cache(session);
+    const uint64_t started = trace::now();
+    const auto response = session.Head();
+    trace_phases(session, started, 0);
+    long http_version = 0;
+    curl_easy_getinfo(session.GetCurlHolder()->handle, CURLINFO_HTTP_VERSION,
+                      &http_version);
+    info.multiplexed = http_version >= CURL_HTTP_VERSION_2_0;
+    // Transfers go straight to where the redirects ended
+    if (!response.url.str().empty())
+      info.url = response.url.str();
     if (header_only) {
       std::cout << response.raw_header << std::endl;
       return info;
@@ -49,10 +248,19 @@ PreDownloadInfo PreDownloadInfo::check_info(const std::string &url,
       info.filename = extract_filename_from_url(url);
     }
 
+    // Weak ETags are not allowed in If-Range
+    if (const auto it = response.header.find("ETag");
+        it != response.header.end() && it->second.rfind("W/", 0) != 0) {
+      info.validator = it->second;
+    } else if (const auto lm = response.header.find("Last-Modified");
+               lm != response.header.end()) {
+      info.validator = lm->second;
+    }
+
     spdlog::info("HEAD response: status={}, content_size={}, accept_ranges={}, "
-                 "filename={}",
+                 "filename={}, multiplexed={}",
                  response.status_code, info.content_size, info.accept_ranges,
-                 info.filename);
+                 info.filename, info.multiplexed);
   } catch (const std::exception &err) {
     spdlog::error("HEAD request falhou: {}", err.what());
   }
@@ -60,39 +268,522 @@ PreDownloadInfo PreDownloadInfo::check_info(const std::string &url,
   return info;
 }
 
+ConnectionBudget::Lease
+DefaultDownloader::acquire_connection(const std::string &url,
+                                      const std::atomic<bool> *stop,
+                                      bool stream) {
+  if (!budget)
+    return {};
+  const std::string origin = extract_origin_from_url(url);
+  if (stream && multiplexer)
+    return budget->acquire_stream(origin, multiplexer->connections_per_host(),
+                                  stop ? stop : &cancelled);
+  return budget->acquire(origin, stop ? stop : &cancelled);
+}
+
 void SingleDownloader::download(const DownloadOptions &options) {
   spdlog::info("single download iniciado: {}", options.url);
+  trace::Span span("single download", "download");
+  auto lease = [&] {
+    trace::Span wait("wait connection", "budget");
+    return acquire_connection(options.url);
+  }();
+  if (is_cancelled()) {
+    emit({CANCELLED, 0, options.c_size, 0.0, 0});
+    emit({CANCELLED, 0, options.c_size, 0.0});
+    return;
+  }
+
   auto start = std::chrono::steady_clock::now();
-  emit({STARTED, 0, options.c_size, 0.0, 0});
+  auto elapsed = [&] {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+  };
+  emit({RUNNING, 0, options.c_size, 0.0, 0});
+
+  const bool to_disk = !extractor || keep_archive;
+  const std::string part = part_path(options.out);
+  int fd = -1;
+  if (to_disk) {
+    fd = open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      spdlog::error("falha ao abrir arquivo: {}", part);
+      if (extractor)
+        extractor->abort();
+      emit({FAILED, 0, options.c_size, 0.0});
+      return;
+    }
+  }
+  CacheMode mode = cache_mode;
+  const int direct_fd = to_disk ? open_for_cache_mode(part, mode) : -1;
+  std::optional<DirectWriter> direct;
+  if (direct_fd >= 0)
+    direct.emplace(direct_fd, fd);
+  WriteBack writeback(fd, sync_policy, sync_batch,
+                      mode == CacheMode::DONTNEED);
 
-  std::ofstream ofs(options.out, std::ios::binary);
+  size_t written = 0;
+  bool disk_ok = true;
+  auto last_emit = start;
+  WriteTrace writes;
 
-  if (!ofs.is_open()) {
-    spdlog::error("falha ao abrir arquivo: {}", options.out);
-    emit({FAILED, 0, options.c_size, 0.0});
-    return;
+  cpr::Session session;
+  session.SetUrl(cpr::Url{options.url});
+  use_shared_cache(session);
+  session.SetWriteCallback(
+      cpr::WriteCallback{[&](const std::string_view &data, intptr_t) {
+        if (extractor && !extractor->feed(data.data(), data.size()))
+          return false;
+        if (to_disk) {
+          const uint64_t began = writes.start();
+          disk_ok = direct ? direct->write(data.data(), data.size(), written)
+                           : write_at(fd, data.data(), data.size(), written);
+          writes.done(began, data.size());
+          if (disk_ok)
+            writeback.wrote(data.size());
+        }
+        written += data.size();
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_emit >= std::chrono::milliseconds(250)) {
+          last_emit = now;
+          emit({RUNNING, written, options.c_size, elapsed(), 0});
+        }
+        return disk_ok && !is_cancelled();
+      }});
+  session.SetProgressCallback(cpr::ProgressCallback{
+      [&](cpr::cpr_pf_arg_t, cpr::cpr_pf_arg_t, cpr::cpr_pf_arg_t,
+          cpr::cpr_pf_arg_t, intptr_t) { return !is_cancelled(); }});
+
+  const uint64_t started = trace::now();
+  const cpr::Response response = session.Get();
+  trace_phases(session, started, written);
+
+  bool ok = response.status_code == 200 && disk_ok && !is_cancelled();
+  if (extractor) {
+    if (ok) {
+      trace::Span extract("extract tail", "extract");
+      ok = extractor->finish();
+    } else {
+      extractor->abort();
+    }
+  }
+  if (to_disk) {
+    if (ok && direct)
+      ok = direct->flush();
+    if (ok) {
+      trace::Span sync("sync", "disk");
+      ok = writeback.finish();
+    }
+    direct.reset();
+    if (direct_fd >= 0)
+      close(direct_fd);
+    close(fd);
+    if (ok && !publish(part, options.out, sync_policy)) {
+      spdlog::error("falha ao renomear {} para {}", part, options.out);
+      ok = false;
+    }
   }
 
-  if (const cpr::Response response = cpr::Download(ofs, cpr::Url{options.url});
-      response.status_code == 200) {
-    double elapsed =
-        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
-            .count();
+  if (ok) {
     spdlog::info("single download concluido: {} em {:.1f}s", options.url,
-                 elapsed);
-    emit({FINISHED, options.c_size, options.c_size, elapsed, 0});
-    emit({FINISHED, options.c_size, options.c_size, elapsed});
+                 elapsed());
+    emit({FINISHED, written, options.c_size, elapsed(), 0});
+    emit({FINISHED, written, options.c_size, elapsed()});
+  } else if (is_cancelled()) {
+    spdlog::info("single download cancelado: {}", options.url);
+    emit({CANCELLED, written, options.c_size, elapsed(), 0});
+    emit({CANCELLED, written, options.c_size, elapsed()});
   } else {
-    double elapsed =
-        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
-            .count();
     spdlog::error("single download falhou: status_code={}, error={}",
                   response.status_code, response.error.message);
-    emit({FAILED, 0, options.c_size, elapsed, 0});
-    emit({FAILED, 0, options.c_size, elapsed});
+    emit({FAILED, 0, options.c_size, elapsed(), 0});
+    emit({FAILED, 0, options.c_size, elapsed()});
   }
 }
 
+namespace {
+
+// Per-range transfer state shared between a segment worker and the monitor
+// loop in ParalellDownloader::download.
+struct Segment {
+  size_t begin;
+  size_t end; // inclusive
+  std::atomic<size_t> offset;
+  std::atomic<bool> abort{false};
+  std::atomic<int> retries{0};
+  std::atomic<int> stalls{0};
+  std::atomic<DownloadStatus> status{STARTED};
+  std::atomic<double> elapsed{0.0};
+  std::atomic<double> ttfb{0.0};
+  // The other racer over this segment's tail: its hedge, or on a hedge the
+  // segment it races. Whichever reaches `end` first completes both.
+  std::atomic<Segment *> rival{nullptr};
+  bool hedge = false; // hedges only take 206s and are never retried
+
+  // Address the current connection went to, so a hedge can go elsewhere
+  std::mutex peer_mutex;
+  std::string peer;
+
+  // Under O_DIRECT, both racers write the tail's blocks, and the unaligned
+  // ends of their runs go through the page cache. The kernel only keeps a
+  // block coherent across the two paths when the writes don't overlap in
+  // time, so a segment and its hedge take turns.
+  std::mutex disk_mutex;
+  std::mutex &disk() { return hedge ? rival.load()->disk_mutex : disk_mutex; }
+
+  // Owned by the monitor loop
+  size_t window_start = 0;
+  int windows = 0;
+  int seen_retries = 0;
+  size_t hedge_mark; // offset at the previous tick
+  double recent_rate = 0.0;
+
+  Segment(size_t b, size_t e) : begin(b), end(e), offset(b), hedge_mark(b) {}
+
+  size_t size() const { return end - begin + 1; }
+  bool rival_won() const {
+    const Segment *other = rival.load();
+    return other && other->offset.load() > other->end;
+  }
+  bool finished() const { return offset.load() > end || rival_won(); }
+  size_t done() const { return finished() ? size() : offset.load() - begin; }
+};
+
+// Set when the server answers a range request with the whole file (200):
+// the first worker to see it keeps that stream for the entire download and
+// every other segment stands down instead of pulling the file again.
+struct WholeFile {
+  std::atomic<int> owner{-1};
+  std::atomic<size_t> written{0};
+  size_t total;
+
+  explicit WholeFile(size_t size) : total(size) {}
+  bool active() const { return owner.load() >= 0; }
+};
+
+// Body bytes a multiplexed stream received but hasn't written yet. The
+// callback on the multiplexer's thread appends them; the segment's worker,
+// blocked in Multiplexer::get, writes them out, so a pwrite or a batch
+// waiting on writeback never holds up the other streams. A stream whose
+// worker falls LIMIT behind is paused, never waited on: the multiplexer's
+// thread drives every stream, and their abort checks with them.
+struct Handoff {
+  static constexpr size_t LIMIT = 4 * 1024 * 1024;
+
+  std::mutex mutex;
+  std::string bytes;
+  size_t at = 0; // file offset of bytes[0]
+  bool failed = false;
+  bool paused = false; // the next drain resumes the stream
+  std::function<bool(std::string_view)> body;
+
+  // CURLOPT_WRITEFUNCTION of the stream: `body`, unless the worker is
+  // behind, in which case libcurl holds the data until it is resumed
+  static size_t write(char *data, size_t size, size_t count, void *self) {
+    auto &handoff = *static_cast<Handoff *>(self);
+    {
+      std::lock_guard lock(handoff.mutex);
+      if (handoff.bytes.size() >= Handoff::LIMIT && !handoff.failed) {
+        handoff.paused = true;
+        return CURL_WRITEFUNC_PAUSE;
+      }
+    }
+    const size_t n = size * count;
+    return handoff.body({data, n}) ? n : 0;
+  }
+};
+
+// UNSUPPORTED: the native client can't handle this origin; use libcurl
+enum class FetchResult { DONE, RETRY, WRITE_ERROR, SUPERSEDED, UNSUPPORTED };
+
+// Streams the remaining bytes of `seg` (or of the whole file once this
+// worker owns a 200 stream) into `fd` on a fresh connection, or as a new
+// stream on `mux`. The first body bytes are only written after the status
+// and Content-Range match what was asked for; on RETRY, seg.offset /
+// whole.written mark where to resume. `connect_to` redirects the connection
+// to another address of the host (CURLOPT_CONNECT_TO); `if_range` makes a
+// server holding a different copy answer 200 instead of mixing in its bytes.
+FetchResult fetch_range(const std::string &url, int fd, Segment &seg,
+                        int index, WholeFile &whole,
+                        const std::atomic<bool> &cancelled, Multiplexer *mux,
+                        WriteBack &writeback, DirectWriter *direct,
+                        curl_slist *connect_to = nullptr,
+                        const std::string &if_range = {}) {
+  bool owning = whole.owner.load() == index;
+  const size_t from = owning ? whole.written.load() : seg.offset.load();
+  const size_t last = owning ? whole.total - 1 : seg.end;
+  std::string range_value =
+      "bytes=" + std::to_string(from) + "-" + std::to_string(last);
+
+  trace::Span span("request", "segment");
+  span.value = seg.retries.load();
+  span.value_name = "attempt";
+
+  long status_code = 0;
+  bool has_range = false;
+  size_t range_first = 0, range_last = 0;
+  bool validated = false;
+  bool superseded = false;
+  bool write_error = false;
+  size_t pos = 0; // file offset of the next body byte
+  size_t received = 0;
+  auto cursor = [&]() -> std::atomic<size_t> & {
+    return owning ? whole.written : seg.offset;
+  };
+  WriteTrace writes;
+  auto store = [&](const char *data, size_t n, size_t at) {
+    const uint64_t began = writes.start();
+    if (direct) {
+      std::lock_guard lock(seg.disk());
+      if (!direct->write(data, n, at))
+        return false;
+    } else if (!write_at(fd, data, n, at)) {
+      return false;
+    }
+    writes.done(began, n);
+    cursor().store(at + n);
+    received += n;
+    writeback.wrote(n);
+    return true;
+  };
+
+  cpr::Session session;
+  // On a stream, where the bytes handed off so far end
+  Handoff handoff;
+  std::optional<size_t> queued;
+  // Resumed before the write, so the next LIMIT arrives while it runs
+  auto drain = [&] {
+    std::string chunk;
+    size_t at;
+    bool paused;
+    {
+      std::lock_guard lock(handoff.mutex);
+      if (!handoff.failed)
+        chunk.swap(handoff.bytes);
+      at = handoff.at;
+      paused = std::exchange(handoff.paused, false);
+    }
+    if (paused)
+      mux->resume(session.GetCurlHolder()->handle);
+    if (chunk.empty() || store(chunk.data(), chunk.size(), at))
+      return;
+    {
+      std::lock_guard lock(handoff.mutex);
+      handoff.failed = true;
+      paused = std::exchange(handoff.paused, false);
+    }
+    // Lets the stream see `failed` and end
+    if (paused)
+      mux->resume(session.GetCurlHolder()->handle);
+  };
+
+  const auto requested = std::chrono::steady_clock::now();
+  session.SetUrl(cpr::Url{url});
+  cpr::Header headers{{"Range", range_value}};
+  if (!if_range.empty())
+    headers["If-Range"] = if_range;
+  session.SetHeader(headers);
+  use_shared_cache(session, mux == nullptr);
+  if (connect_to)
+    curl_easy_setopt(session.GetCurlHolder()->handle, CURLOPT_CONNECT_TO,
+                     connect_to);
+  session.SetHeaderCallback(
+      cpr::HeaderCallback{[&](const std::string_view &line, intptr_t) {
+        // A redirect chain carries one header block per response
+        if (const long code = parse_status_line(line); code != 0) {
+          status_code = code;
+          has_range = false;
+        } else if (parse_content_range(line, range_first, range_last)) {
+          has_range = true;
+        }
+        return true;
+      }});
+  auto body = [&](std::string_view data) {
+    if (seg.abort.load() || cancelled.load() || seg.rival_won())
+      return false;
+
+    if (!validated) {
+      validated = true;
+      seg.ttfb = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - requested)
+                     .count();
+      if (status_code == 206) {
+        if (!has_range || range_first != from || range_last > last) {
+          spdlog::warn("range {}-{}: Content-Range inesperado ({}-{})",
+                       from, last, range_first, range_last);
+          return false;
+        }
+        pos = from;
+        char *ip = nullptr;
+        curl_easy_getinfo(session.GetCurlHolder()->handle, CURLINFO_PRIMARY_IP,
+                          &ip);
+        std::lock_guard lock(seg.peer_mutex);
+        seg.peer = ip ? ip : "";
+      } else if (status_code == 200 && seg.hedge) {
+        // Another copy of the file, or Range ignored: the segment
+        // already covers this, so the hedge just gives up
+        spdlog::warn("hedge {}-{}: resposta 200, descartado", from, last);
+        return false;
+      } else if (status_code == 200) {
+        int expected = -1;
+        if (!owning && !whole.owner.compare_exchange_strong(expected, index)) {
+          superseded = true;
+          return false;
+        }
+        if (!owning) {
+          spdlog::warn("servidor ignorou Range em {}: seguindo com um "
+                       "unico fluxo na thread {}",
+                       url, index);
+          trace::instant("range ignored", "segment");
+        }
+        owning = true;
+        pos = 0;
+      } else {
+        return false;
+      }
+    }
+
+    // Someone else already streams the whole file
+    if (!owning && whole.active()) {
+      superseded = true;
+      return false;
+    }
+
+    // Skip what an earlier attempt already wrote (a 200 restarts at 0)
+    const size_t cur = queued ? *queued : cursor().load();
+    const size_t end = owning ? whole.total : seg.end + 1;
+    const size_t skip = cur > pos ? std::min(data.size(), cur - pos) : 0;
+    pos += data.size();
+    if (skip == data.size() || cur >= end)
+      return true;
+    const size_t n = std::min(data.size() - skip, end - cur);
+
+    if (!mux) {
+      if (store(data.data() + skip, n, cur))
+        return true;
+      write_error = true;
+      return false;
+    }
+
+    std::lock_guard lock(handoff.mutex);
+    if (handoff.failed) {
+      write_error = true;
+      return false;
+    }
+    const bool idle = handoff.bytes.empty();
+    if (idle)
+      handoff.at = cur;
+    handoff.bytes.append(data.data() + skip, n);
+    queued = cur + n;
+    if (idle)
+      mux->wake(session.GetCurlHolder()->handle);
+    return true;
+  };
+  session.SetWriteCallback(cpr::WriteCallback{
+      [&](const std::string_view &data, intptr_t) { return body(data); }});
+  // Replaces cpr's writer, which keeps it as long as a WriteCallback is set
+  if (mux) {
+    handoff.body = body;
+    curl_easy_setopt(session.GetCurlHolder()->handle, CURLOPT_WRITEFUNCTION,
+                     &Handoff::write);
+    curl_easy_setopt(session.GetCurlHolder()->handle, CURLOPT_WRITEDATA,
+                     &handoff);
+  }
+  // Keeps the abort flag effective while no body bytes arrive at all
+  session.SetProgressCallback(cpr::ProgressCallback{
+      [&](cpr::cpr_pf_arg_t, cpr::cpr_pf_arg_t, cpr::cpr_pf_arg_t,
+          cpr::cpr_pf_arg_t, intptr_t) {
+        return !seg.abort.load() && !cancelled.load() && !seg.rival_won();
+      }});
+
+  const uint64_t started = trace::now();
+  const auto response = mux ? mux->get(session, drain) : session.Get();
+  if (mux) {
+    drain();
+    if (handoff.failed)
+      write_error = true;
+  }
+  trace_phases(session, started, received);
+  // Staged bytes must be in the file before anyone resumes from the cursor
+  if (direct) {
+    std::lock_guard lock(seg.disk());
+    if (!direct->flush())
+      write_error = true;
+  }
+
+  if (owning ? whole.written.load() >= whole.total : seg.finished())
+    return FetchResult::DONE;
+  if (superseded)
+    return FetchResult::SUPERSEDED;
+  if (write_error)
+    return FetchResult::WRITE_ERROR;
+
+  if (!seg.abort.load() && !cancelled.load()) {
+    spdlog::error("range {}-{} falhou: status_code={}, error={}", from, last,
+                  response.status_code, response.error.message);
+  }
+  return FetchResult::RETRY;
+}
+
+// fetch_range over native_http: plain HTTP/1.1, body spliced from the socket
+// into `fd`. Never sees a 200 (that is UNSUPPORTED and left to fetch_range).
+FetchResult fetch_range_native(const std::string &url, int fd, Segment &seg,
+                               const std::atomic<bool> &cancelled,
+                               WriteBack &writeback, size_t max_idle) {
+  native_http::RangeRequest request;
+  request.url = url;
+  request.fd = fd;
+  request.from = seg.offset.load();
+  request.last = seg.end;
+  request.max_idle = max_idle;
+
+  trace::Span span("request (native)", "segment");
+  span.value = seg.retries.load();
+  span.value_name = "attempt";
+
+  const auto requested = std::chrono::steady_clock::now();
+  request.keep_going = [&] {
+    return !seg.abort.load() && !cancelled.load() && !seg.rival_won();
+  };
+  request.on_response = [&] {
+    seg.ttfb = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             requested)
+                   .count();
+  };
+  request.on_written = [&](size_t offset, size_t size) {
+    seg.offset.store(offset + size);
+    writeback.wrote(size);
+  };
+
+  switch (native_http::fetch(request)) {
+  case native_http::Result::DONE:
+    // A server that caps range sizes ends its 206 early: the rest is asked
+    // for again from seg.offset, as fetch_range does
+    if (seg.finished())
+      return FetchResult::DONE;
+    spdlog::warn("range {}-{}: servidor respondeu ate {} (native http)",
+                 request.from, request.last, seg.offset.load() - 1);
+    return FetchResult::RETRY;
+  case native_http::Result::UNSUPPORTED:
+    return FetchResult::UNSUPPORTED;
+  case native_http::Result::WRITE_ERROR:
+    return FetchResult::WRITE_ERROR;
+  case native_http::Result::RETRY:
+    break;
+  }
+  if (seg.rival_won())
+    return FetchResult::DONE;
+  if (!seg.abort.load() && !cancelled.load()) {
+    spdlog::error("range {}-{} falhou (native http)", request.from,
+                  request.last);
+  }
+  return FetchResult::RETRY;
+}
+
+} // namespace
+
 void ParalellDownloader::download(const DownloadOptions &options) {
   spdlog::info("parallel download iniciado: {} ({} threads)", options.url,
                thread_count);
@@ -102,68 +793,435 @@ void ParalellDownloader::download(const DownloadOptions &options) {
   const auto ranges =
       split_ranges(options.c_size, static_cast<size_t>(thread_count));
 
+  std::vector<std::unique_ptr<Segment>> segments;
+  segments.reserve(ranges.size());
+  for (const auto &r : ranges) {
+    segments.push_back(std::make_unique<Segment>(
+        static_cast<size_t>(r.resume_from), static_cast<size_t>(r.finish_at)));
+  }
+
   // Emit initial state for each thread so the UI knows about them
-  for (int i = 0; i < static_cast<int>(ranges.size()); ++i) {
-    size_t chunk_size = ranges[i].finish_at - ranges[i].resume_from + 1;
-    emit({STARTED, 0, chunk_size, 0.0, i});
+  for (int i = 0; i < static_cast<int>(segments.size()); ++i) {
+    emit({STARTED, 0, segments[i]->size(), 0.0, i});
   }
 
-  int fd = open(options.out.c_str(), O_WRONLY);
+  const std::string part = part_path(options.out);
+  int fd = open(part.c_str(), O_WRONLY);
 
   if (fd < 0) {
-    spdlog::error("falha ao abrir arquivo para escrita: {}", options.out);
+    spdlog::error("falha ao abrir arquivo para escrita: {}", part);
     emit({FAILED, 0, options.c_size, 0.0});
     return;
   }
+  // The extractor reads the file while it grows, which staged O_DIRECT
+  // bytes would hide from it
+  CacheMode mode = cache_mode;
+  if (extractor && mode == CacheMode::DIRECT)
+    mode = CacheMode::DONTNEED;
+  const int direct_fd = open_for_cache_mode(part, mode);
+  WriteBack writeback(fd, sync_policy, sync_batch,
+                      mode == CacheMode::DONTNEED);
+
+  if (extractor)
+    extractor->follow(part);
+
+  // splice() goes through the page cache, so it is off under O_DIRECT
+  const bool native = use_native_http && direct_fd < 0 &&
+                      native_http::supported(options.url);
+  if (native)
+    spdlog::info("parallel download via http nativo (splice): {}",
+                 options.url);
+  // Idle keep-alive sockets kept per origin, as many as it may have open
+  const size_t max_idle = static_cast<size_t>(std::max(
+      1, per_origin_connections() > 0 ? per_origin_connections() : thread_count));
+
+  WholeFile whole(options.c_size);
 
   std::vector<std::future<void>> futures;
-  futures.reserve(ranges.size());
+  futures.reserve(segments.size());
+
+  for (int i = 0; i < static_cast<int>(segments.size()); ++i) {
+    Segment &seg = *segments[i];
+    SPDLOG_DEBUG("thread {} range {}-{}", i, seg.begin, seg.end);
+    futures.emplace_back(std::async(std::launch::async, [this, &options, &seg,
+                                                         &whole, &writeback,
+                                                         fd, direct_fd, native,
+                                                         max_idle, i] {
+      trace::set_track(options.id, i);
+      trace::Span span("segment", "segment");
+      span.value = static_cast<int64_t>(seg.size());
+      span.value_name = "bytes";
+
+      // Waiting for a slot is not a stall: the monitor only judges RUNNING
+      auto lease = [&] {
+        trace::Span wait("wait connection", "budget");
+        return acquire_connection(options.url, nullptr, !native);
+      }();
+      if (is_cancelled()) {
+        seg.status = CANCELLED;
+        return;
+      }
 
-  for (int i = 0; i < static_cast<int>(ranges.size()); ++i) {
-    const auto &r = ranges[i];
-    spdlog::debug("thread {} range {}-{}", i, r.resume_from, r.finish_at);
-    futures.emplace_back(std::async(std::launch::async, [this, &options, r, fd,
-                                                         start, i] {
       auto thread_start = std::chrono::steady_clock::now();
-      size_t chunk_size = r.finish_at - r.resume_from + 1;
+      auto elapsed = [&] {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             thread_start)
+            .count();
+      };
+
+      std::optional<DirectWriter> direct;
+      if (direct_fd >= 0)
+        direct.emplace(direct_fd, fd);
+      bool use_native = native;
 
-      std::string range_value = "bytes=" + std::to_string(r.resume_from) + "-" +
-                                std::to_string(r.finish_at);
+      seg.status = RUNNING;
+      while (true) {
+        if (whole.active() && whole.owner.load() != i) {
+          // The server ignores Range; the owner of the 200 stream covers us
+          seg.elapsed = elapsed();
+          seg.status = CANCELLED;
+          SPDLOG_DEBUG("thread {} dispensada: outro fluxo baixa o arquivo", i);
+          return;
+        }
 
-      const auto response =
-          cpr::Get(cpr::Url{options.url}, cpr::Header{{"Range", range_value}});
+        // A hedge may have fetched the rest while this attempt was failing
+        const FetchResult result =
+            seg.rival_won() ? FetchResult::DONE
+            : use_native
+                ? fetch_range_native(options.url, fd, seg, cancelled, writeback,
+                                     max_idle)
+                : fetch_range(options.url, fd, seg, i, whole, cancelled,
+                              multiplexer, writeback,
+                              direct ? &*direct : nullptr);
+        if (result == FetchResult::DONE) {
+          seg.elapsed = elapsed();
+          seg.status = FINISHED;
+          SPDLOG_DEBUG("thread {} concluido: {} bytes em {:.1f}s", i,
+                       seg.size(), seg.elapsed.load());
+          return;
+        }
 
-      double thread_elapsed =
-          std::chrono::duration<double>(std::chrono::steady_clock::now() - thread_start).count();
+        if (is_cancelled()) {
+          seg.elapsed = elapsed();
+          seg.status = CANCELLED;
+          return;
+        }
 
-      if (response.status_code == 206) {
-        ssize_t written = pwrite(fd, response.text.data(), response.text.size(),
-                                 static_cast<off_t>(r.resume_from));
+        if (result == FetchResult::SUPERSEDED)
+          continue;
 
-        if (written < 0) {
+        if (result == FetchResult::UNSUPPORTED) {
+          // Nothing was written; the same attempt goes through libcurl
+          SPDLOG_DEBUG("thread {}: resposta fora do http nativo, usando cpr", i);
+          use_native = false;
+          continue;
+        }
+
+        if (result == FetchResult::WRITE_ERROR) {
           spdlog::error("thread {} pwrite falhou", i);
-          emit({FAILED, 0, chunk_size, thread_elapsed, i});
-          return;
+          break;
         }
 
-        spdlog::info("thread {} concluido: {} bytes em {:.1f}s", i,
-                     response.text.size(), thread_elapsed);
-        emit({FINISHED, response.text.size(), chunk_size, thread_elapsed, i});
-      } else {
-        spdlog::error("thread {} falhou: status_code={}, error={}", i,
-                      response.status_code, response.error.message);
-        emit({FAILED, 0, chunk_size, thread_elapsed, i});
+        const bool stalled = seg.abort.exchange(false);
+        if (stalled)
+          seg.stalls++;
+        const int attempt = ++seg.retries;
+        const bool owner = whole.owner.load() == i;
+        const size_t resume = owner ? whole.written.load() : seg.offset.load();
+        const size_t last = owner ? whole.total - 1 : seg.end;
+        trace::instant(stalled ? "retry (stall)" : "retry (error)", "segment",
+                       static_cast<int64_t>(last + 1 - resume), "remaining");
+        if (attempt > max_retries) {
+          spdlog::error("thread {} excedeu {} tentativas", i, max_retries);
+          break;
+        }
+        spdlog::warn("thread {} {}: reemitindo {}-{} em nova conexao "
+                     "(tentativa {}/{})",
+                     i, stalled ? "travada" : "falhou", resume, last, attempt,
+                     max_retries);
       }
+
+      seg.elapsed = elapsed();
+      seg.status = FAILED;
     }));
   }
 
-  for (auto &f : futures) {
-    f.get();
+  // Everything before the first unfinished segment's offset is final
+  auto feed_extractor = [&] {
+    if (!extractor)
+      return;
+    size_t frontier = 0;
+    if (whole.active()) {
+      extractor->advance(whole.written.load());
+      return;
+    }
+    for (const auto &seg : segments) {
+      frontier = seg->finished() ? seg->end + 1 : seg->offset.load();
+      if (seg->status.load() != FINISHED)
+        break;
+    }
+    extractor->advance(frontier);
+  };
+
+  auto emit_segments = [&] {
+    for (int i = 0; i < static_cast<int>(segments.size()); ++i) {
+      const Segment &seg = *segments[i];
+      const DownloadStatus status = seg.status.load();
+      double elapsed = seg.elapsed.load();
+      if (status != FINISHED && status != FAILED && status != CANCELLED) {
+        elapsed = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      }
+      // With a single 200 stream, its owner reports the whole file and the
+      // stood-down segments report nothing
+      size_t done = seg.done();
+      size_t size = seg.size();
+      if (const int owner = whole.owner.load(); owner >= 0) {
+        done = owner == i ? whole.written.load() : 0;
+        size = owner == i ? whole.total : size;
+      }
+      emit({status, done, size, elapsed, i, seg.retries.load(),
+            seg.stalls.load(), seg.ttfb.load()});
+    }
+  };
+
+  // Once most of the file is in, the tails of the slowest segments are raced
+  // by a second request, on another address of the host when it has one.
+  // Neither racer is told it lost: both stop as soon as one reaches the end.
+  std::vector<std::unique_ptr<Segment>> hedges;
+  std::vector<std::future<void>> hedge_futures;
+  auto duplicated = [&] {
+    size_t bytes = 0;
+    for (const auto &hedge : hedges) {
+      bytes += HedgePlanner::overlap(hedge->rival.load()->offset.load(),
+                                     hedge->begin, hedge->offset.load());
+    }
+    return bytes;
+  };
+  auto hedge_tick = start;
+  auto launch_hedges = [&] {
+    const auto now = std::chrono::steady_clock::now();
+    const double running_for =
+        std::chrono::duration<double>(now - start).count();
+    const double since = std::chrono::duration<double>(now - hedge_tick).count();
+    hedge_tick = now;
+    std::vector<HedgeSample> samples;
+    samples.reserve(segments.size());
+    for (const auto &seg : segments) {
+      const size_t offset = seg->offset.load();
+      const bool finished = seg->finished();
+      seg->recent_rate = HedgePlanner::smooth(
+          seg->recent_rate, static_cast<double>(offset - seg->hedge_mark) / since);
+      seg->hedge_mark = offset;
+      samples.push_back(
+          {finished ? 0 : seg->end + 1 - offset, seg->recent_rate,
+           static_cast<double>(offset - seg->begin) /
+               (finished && seg->elapsed.load() > 0.0 ? seg->elapsed.load()
+                                                      : running_for),
+           seg->status.load() == RUNNING, seg->rival.load() != nullptr});
+    }
+
+    for (const size_t i :
+         hedge_planner.pick(samples, options.c_size, duplicated())) {
+      Segment &seg = *segments[i];
+      // Under O_DIRECT, starting on a block boundary (or at the segment's
+      // own head) keeps the hedge's writes direct like the segment's, rather
+      // than sending its first partial block through the page cache
+      size_t from = seg.offset.load();
+      if (direct_fd >= 0)
+        from = std::max(seg.begin, from - from % DirectWriter::BLOCK);
+      Segment &hedge = *hedges.emplace_back(
+          std::make_unique<Segment>(from, seg.end));
+      hedge.hedge = true;
+      hedge.rival = &seg;
+      seg.rival = &hedge;
+      spdlog::info("thread {} atrasada: duplicando {}-{} em outra conexao", i,
+                   hedge.begin, hedge.end);
+      trace::instant("hedge", "segment", static_cast<int64_t>(hedge.size()),
+                     "bytes");
+
+      // Hedges get the tracks after the segments'
+      const int track = static_cast<int>(segments.size() + i);
+      hedge_futures.emplace_back(std::async(std::launch::async, [this, &options,
+                                                                &seg, &hedge,
+                                                                &whole,
+                                                                &writeback, fd,
+                                                                direct_fd, i,
+                                                                track] {
+        trace::set_track(options.id, track);
+        trace::Span span("hedge", "segment");
+        span.value = static_cast<int64_t>(hedge.size());
+        span.value_name = "bytes";
+
+        auto lease = [&] {
+          trace::Span wait("wait connection", "budget");
+          return acquire_connection(options.url, &hedge.abort);
+        }();
+        if (is_cancelled() || hedge.abort.load() || hedge.finished()) {
+          if (!hedge.finished())
+            seg.rival = nullptr;
+          return;
+        }
+
+        std::string avoid;
+        {
+          std::lock_guard lock(seg.peer_mutex);
+          avoid = seg.peer;
+        }
+        // Without a validator another replica's bytes can't be checked
+        curl_slist *connect_to = nullptr;
+        if (hedge_planner.policy().other_address && !options.if_range.empty()) {
+          if (const std::string entry = alternate_address(options.url, avoid);
+              !entry.empty()) {
+            SPDLOG_DEBUG("hedge da thread {} via {}", i, entry);
+            connect_to = curl_slist_append(nullptr, entry.c_str());
+          }
+        }
+
+        std::optional<DirectWriter> direct;
+        if (direct_fd >= 0)
+          direct.emplace(direct_fd, fd);
+        // One attempt: on failure the segment simply keeps its own
+        fetch_range(options.url, fd, hedge, i, whole, cancelled, nullptr,
+                    writeback, direct ? &*direct : nullptr, connect_to,
+                    options.if_range);
+        curl_slist_free_all(connect_to);
+
+        if (hedge.offset.load() > hedge.end) {
+          spdlog::info("hedge da thread {} terminou primeiro", i);
+        } else if (!hedge.finished()) {
+          // Failed: the segment may be hedged again, within what is left of
+          // the budget
+          seg.rival = nullptr;
+        }
+      }));
+    }
+  };
+
+  // Monitor: publish progress and abort connections that stall relative to
+  // the absolute floor or their peers; the worker re-issues the remainder.
+  constexpr auto tick = std::chrono::milliseconds(250);
+  const auto window = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(stall_detector.policy().window_seconds));
+  auto window_start = std::chrono::steady_clock::now();
+
+  for (auto &seg : segments) {
+    seg->window_start = seg->offset.load();
+  }
+
+  auto all_ready = [&](const std::vector<std::future<void>> &pending) {
+    return std::all_of(pending.begin(), pending.end(), [&](const auto &f) {
+      return f.wait_for(tick) == std::future_status::ready;
+    });
+  };
+
+  // Hedges that outlive their segment's worker may still complete it
+  while (!all_ready(futures) || !all_ready(hedge_futures)) {
+    emit_segments();
+    feed_extractor();
+
+    if (hedge_planner.enabled() && !whole.active())
+      launch_hedges();
+    // Stops hedges whose race is over or that the budget no longer covers,
+    // including those still queued for a connection slot
+    const bool spent = hedge_planner.exhausted(duplicated(), options.c_size);
+    for (auto &hedge : hedges) {
+      if (spent || hedge->finished() || is_cancelled())
+        hedge->abort = true;
+    }
+
+    // A lone stream has no peers to be judged against
+    if (std::chrono::steady_clock::now() - window_start < window ||
+        whole.active())
+      continue;
+    window_start = std::chrono::steady_clock::now();
+
+    std::vector<SegmentSample> samples;
+    samples.reserve(segments.size());
+    for (auto &seg : segments) {
+      const size_t offset = seg->offset.load();
+      const int retries = seg->retries.load();
+      const bool running = seg->status.load() == RUNNING;
+      if (!running || retries != seg->seen_retries) {
+        // Fresh (or not yet open) connection: restart its grace period
+        seg->seen_retries = retries;
+        seg->windows = 0;
+      }
+      samples.push_back({offset - seg->window_start, seg->windows, running});
+      seg->window_start = offset;
+      if (running)
+        seg->windows++;
+    }
+
+    for (const size_t i : stall_detector.stalled(samples)) {
+      spdlog::warn("thread {} travada: {} bytes em {:.0f}s", i,
+                   samples[i].window_bytes,
+                   stall_detector.policy().window_seconds);
+      segments[i]->abort = true;
+    }
+  }
+
+  // A worker that gave up on its retries is covered by a hedge that finished
+  for (auto &seg : segments) {
+    if (seg->status.load() == FAILED && seg->finished())
+      seg->status = FINISHED;
   }
+  emit_segments();
+
+  bool failed =
+      std::any_of(segments.begin(), segments.end(),
+                  [](const auto &seg) { return seg->status.load() == FAILED; });
+  if (!failed && !is_cancelled()) {
+    trace::Span sync("sync", "disk");
+    if (!writeback.finish()) {
+      spdlog::error("fsync falhou: {}", part);
+      failed = true;
+    }
+  }
+  if (direct_fd >= 0)
+    close(direct_fd);
+  close(fd);
 
   double total_elapsed =
       std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
           .count();
+
+  if (extractor && (failed || is_cancelled()))
+    extractor->abort();
+
+  if (is_cancelled()) {
+    spdlog::info("parallel download cancelado: {}", options.url);
+    emit({CANCELLED, 0, options.c_size, total_elapsed});
+    return;
+  }
+
+  if (failed) {
+    spdlog::error("parallel download falhou: {} em {:.1f}s", options.url,
+                  total_elapsed);
+    emit({FAILED, options.c_size, options.c_size, total_elapsed});
+    return;
+  }
+
+  if (extractor) {
+    trace::Span extract("extract tail", "extract");
+    feed_extractor();
+    if (!extractor->finish()) {
+      spdlog::error("parallel download falhou na extracao: {}", options.url);
+      emit({FAILED, options.c_size, options.c_size, total_elapsed});
+      return;
+    }
+    total_elapsed = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  }
+
+  if (!publish(part, options.out, sync_policy)) {
+    spdlog::error("falha ao renomear {} para {}", part, options.out);
+    emit({FAILED, options.c_size, options.c_size, total_elapsed});
+    return;
+  }
+
   spdlog::info("parallel download concluido: {} em {:.1f}s", options.url,
                total_elapsed);
   emit({FINISHED, options.c_size, options.c_size, total_elapsed});
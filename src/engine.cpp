@@ -0,0 +1,560 @@
+#include "engine.h"
+#include "download_manager.h"
+#include "downloader.h"
+#include "trace.h"
+#include "utils.h"
+#include "write_back.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <unordered_set>
+#include <spdlog/spdlog.h>
+
+namespace fs = std::filesystem;
+
+// A cancelled download's .part was preallocated to the full size and is
+// never resumed from (resume restarts the transfer), so it goes. A failed
+// one stays behind for inspection.
+static void discard_part(const std::string& output_path) {
+    if (output_path.empty()) return;
+    std::error_code ec;
+    fs::remove(part_path(output_path), ec);
+}
+
+static DownloadScheduler::Limits scheduler_limits(const AppConfig& config, ConnectionBudget& budget) {
+    DownloadScheduler::Limits limits;
+    limits.max_active = config.max_downloads;
+    limits.spare_connections = [&budget] { return budget.idle_connections(); };
+    limits.max_per_host = config.max_downloads_per_host;
+    limits.policy = config.scheduling == "sef"
+        ? SchedulingPolicy::SHORTEST_FIRST
+        : SchedulingPolicy::FIFO;
+    return limits;
+}
+
+DownloadEngine::DownloadEngine(AppConfig config)
+    : config_(config)
+    , budget_(config.max_total_connections, config.max_connections_per_host)
+    , scheduler_(scheduler_limits(config, budget_))
+    , multiplexer_(config.multiplex_connections)
+    , prober_(config.probe_concurrency, std::chrono::seconds(std::max(0, config.probe_ttl)))
+{
+    prober_.set_on_probed([this](const std::string& url, const PreDownloadInfo& info) {
+        on_probed(url, info);
+    });
+}
+
+DownloadEngine::~DownloadEngine() {
+    shutdown();
+}
+
+void DownloadEngine::start() {
+    exporter_ = std::make_unique<MetricsExporter>(metrics_, config_.metrics_port, config_.metrics_file,
+                                                  config_.metrics_interval);
+    exporter_->start();
+}
+
+void DownloadEngine::shutdown(bool cancel_running) {
+    // Outside the lock: a probe finishing now calls back into on_probed
+    prober_.stop();
+
+    std::unordered_map<uint64_t, std::thread> threads;
+    {
+        std::lock_guard lock(mutex_);
+        accepting_ = false;
+        if (cancel_running) {
+            for (const auto& [id, downloader] : running_) {
+                stop_requests_[id] = PAUSED;
+                downloader->cancel();
+            }
+            for (const auto& d : downloads_) {
+                if (d->status == STARTED) stop_requests_[d->id] = PAUSED;
+            }
+        }
+    }
+
+    // Downloads that finish while we wait must not admit new ones, and the
+    // threads map may still grow until the last running one has settled.
+    while (true) {
+        {
+            std::lock_guard lock(mutex_);
+            threads.swap(threads_);
+            finished_runs_.clear();
+        }
+        if (threads.empty()) break;
+        for (auto& [run, t] : threads) {
+            if (t.joinable()) t.join();
+        }
+        threads.clear();
+    }
+
+    if (exporter_) {
+        exporter_->stop();
+        exporter_.reset();
+    }
+}
+
+DownloadEntry* DownloadEngine::find(int id) {
+    auto it = entries_by_id_.find(id);
+    return it == entries_by_id_.end() ? nullptr : it->second;
+}
+
+void DownloadEngine::touch(DownloadEntry* entry) {
+    entry->version = ++revision_;
+}
+
+void DownloadEngine::notify() {
+    if (on_change_) on_change_();
+}
+
+int DownloadEngine::enqueue(const std::string& url, const std::string& output_dir,
+                            DownloadPriority priority) {
+    std::lock_guard lock(mutex_);
+    if (url.empty() || !accepting_) return -1;
+
+    auto entry = std::make_unique<DownloadEntry>();
+    entry->id = next_id_++;
+    entry->url = url;
+    entry->output_dir = output_dir.empty() ? "." : output_dir;
+    entry->origin = download_manager::utils::extract_origin_from_url(url);
+    entry->priority = priority;
+    entry->status = PENDING;
+    touch(entry.get());
+
+    const int id = entry->id;
+    scheduler_.enqueue(id, entry->origin, entry->priority);
+    entries_by_id_[id] = entry.get();
+    pending_by_url_[url].push_back(id);
+    downloads_.push_back(std::move(entry));
+    prober_.request(url);
+
+    try_start_queued();
+    notify();
+    return id;
+}
+
+bool DownloadEngine::set_priority(int id, DownloadPriority priority) {
+    std::lock_guard lock(mutex_);
+    DownloadEntry* entry = find(id);
+    if (!entry || entry->status != PENDING) return false;
+
+    entry->priority = priority;
+    scheduler_.reprioritize(id, priority);
+    touch(entry);
+    notify();
+    return true;
+}
+
+bool DownloadEngine::pause(int id) {
+    return stop(id, PAUSED);
+}
+
+bool DownloadEngine::cancel(int id) {
+    return stop(id, CANCELLED);
+}
+
+bool DownloadEngine::stop(int id, DownloadStatus status) {
+    std::lock_guard lock(mutex_);
+    DownloadEntry* entry = find(id);
+    if (!entry) return false;
+
+    if (entry->status == PENDING) {
+        scheduler_.remove(id);
+        unindex_pending(entry);
+        entry->status = status;
+        touch(entry);
+        if (status == CANCELLED) retire(id);
+        metrics_.set_queue_depth(scheduler_.queued());
+        notify();
+        return true;
+    }
+
+    if (entry->status == PAUSED && status == CANCELLED) {
+        entry->status = CANCELLED;
+        touch(entry);
+        discard_part(entry->output_path);
+        retire(id);
+        notify();
+        return true;
+    }
+
+    if (entry->status != STARTED && entry->status != RUNNING) return false;
+
+    // The download thread settles the entry once the transfer has stopped
+    stop_requests_[id] = status;
+    if (auto it = running_.find(id); it != running_.end()) {
+        it->second->cancel();
+    }
+    return true;
+}
+
+bool DownloadEngine::resume(int id) {
+    std::lock_guard lock(mutex_);
+    DownloadEntry* entry = find(id);
+    if (!entry || !accepting_) return false;
+    if (entry->status != PAUSED && entry->status != FAILED && entry->status != CANCELLED) return false;
+
+    // Transfers restart from scratch: nothing on disk records which ranges
+    // were complete.
+    entry->status = PENDING;
+    entry->bytes_downloaded = 0;
+    entry->elapsed_seconds = 0.0;
+    entry->threads.clear();
+    touch(entry);
+    retired_.erase(id);
+    pending_by_url_[entry->url].push_back(id);
+    scheduler_.enqueue(id, entry->origin, entry->priority, entry->content_size);
+    prober_.request(entry->url);
+
+    try_start_queued();
+    notify();
+    return true;
+}
+
+void DownloadEngine::apply_config(const AppConfig& config) {
+    std::lock_guard lock(mutex_);
+    config_ = config;
+    budget_.set_limits(config_.max_total_connections, config_.max_connections_per_host);
+    scheduler_.set_limits(scheduler_limits(config_, budget_));
+    try_start_queued();
+}
+
+void DownloadEngine::read(const std::function<void(const Entries&)>& fn) {
+    std::lock_guard lock(mutex_);
+    fn(downloads_);
+}
+
+void DownloadEngine::set_on_change(std::function<void()> callback) {
+    std::lock_guard lock(mutex_);
+    on_change_ = std::move(callback);
+}
+
+void DownloadEngine::start_download(DownloadEntry* entry) {
+    auto callback = [this](int id, const DownloadEvent& event) {
+        on_download_event(id, event);
+    };
+
+    int entry_id = entry->id;
+    std::string url = entry->url;
+    std::string output_dir = entry->output_dir;
+    int max_connections = config_.max_connections;
+    int max_retries = config_.max_retries;
+    std::string transport = config_.transport;
+    bool native_http = config_.native_http;
+    SyncPolicy sync = parse_sync_policy(config_.sync);
+    size_t sync_batch = static_cast<size_t>(std::max(0, config_.sync_batch_mb)) * 1024 * 1024;
+    CacheMode cache_mode = parse_cache_mode(config_.cache_mode);
+    size_t cache_bypass_min = static_cast<size_t>(std::max(0, config_.cache_bypass_min_mb)) * 1024 * 1024;
+    bool extract = config_.extract;
+    bool keep_archive = config_.keep_archive;
+    std::string extract_dir = config_.extract_dir;
+
+    StallPolicy stall;
+    stall.window_seconds = std::max(1, config_.stall_window);
+    stall.min_bytes_per_window = static_cast<size_t>(std::max(0, config_.stall_min_speed)) *
+                                 static_cast<size_t>(stall.window_seconds);
+
+    HedgePolicy hedge;
+    hedge.budget = std::clamp(config_.hedge_budget_pct, 0, 100) / 100.0;
+    hedge.start_fraction = std::clamp(config_.hedge_start_pct, 0, 100) / 100.0;
+    hedge.max_hedges = std::max(0, config_.hedge_max);
+    hedge.other_address = config_.hedge_other_address;
+
+    spdlog::info("download enfileirado: id={} url={}", entry_id, url);
+
+    const uint64_t run = next_run_++;
+    threads_.emplace(run, std::thread([this, entry, entry_id, url, output_dir, max_connections,
+                                       max_retries, stall, hedge, transport, native_http, sync, sync_batch, cache_mode,
+                                       cache_bypass_min, extract, keep_archive, extract_dir, callback,
+                                       run]() {
+        trace::set_track(entry_id);
+        // Usually already resolved while the entry was queued
+        PreDownloadInfo info = prober_.get(url);
+        trace::name_download(entry_id, info.filename);
+
+        std::string output_path = (fs::path(output_dir) / info.filename).string();
+        {
+            std::lock_guard lock(mutex_);
+            entry->filename = info.filename;
+            entry->content_size = info.content_size;
+            entry->accept_ranges = info.accept_ranges;
+            entry->output_path = output_path;
+            touch(entry);
+            // With probe_concurrency=0 this HEAD is the only one: queued
+            // copies of the URL still get sorted by it
+            learn(url, info);
+
+            if (auto it = stop_requests_.find(entry_id); it != stop_requests_.end()) {
+                const DownloadStatus status = it->second;
+                stop_requests_.erase(it);
+                settle(entry, status);
+                finished_runs_.push_back(run);
+                notify();
+                return;
+            }
+            notify();
+        }
+
+        const bool split = DownloadManager::should_split(info.content_size, info.accept_ranges);
+
+        std::unique_ptr<StreamExtractor> extractor;
+        const ArchiveFormat format = ArchiveFormat::detect(info.filename);
+        if (extract && format.extractable()) {
+            if (format.supported()) {
+                extractor = std::make_unique<StreamExtractor>(format, extract_dir.empty() ? output_dir : extract_dir);
+                extractor->start();
+            } else {
+                spdlog::warn("extracao indisponivel para {}: formato nao compilado", info.filename);
+            }
+        }
+        // Parallel segments land out of order, so they always need the file
+        const bool keep = !extractor || keep_archive || split;
+
+        // Pre-allocate the .part file the downloader fills and renames
+        if (keep) {
+            trace::Span span("preallocate", "disk");
+            const std::string part = part_path(output_path);
+            std::ofstream file(part, std::ios::binary);
+            if (!file.is_open()) {
+                spdlog::error("falha na pre-alocacao do arquivo: {}", part);
+            }
+            if (info.content_size > 0) {
+                file.seekp(static_cast<std::streamoff>(info.content_size) - 1);
+                file.write("", 1);
+            }
+            file.close();
+        }
+
+        std::unique_ptr<DefaultDownloader> downloader;
+        if (split) {
+            downloader = std::make_unique<ParalellDownloader>(max_connections, max_retries, stall, hedge);
+        } else {
+            downloader = std::make_unique<SingleDownloader>();
+        }
+
+        downloader->set_connection_budget(&budget_);
+        downloader->set_native_http(native_http);
+        const bool bypass = cache_mode != CacheMode::NORMAL && info.content_size >= cache_bypass_min;
+        if (bypass) downloader->set_cache_mode(cache_mode);
+        // Dropping pages needs batches to wait on, even without batched sync
+        downloader->set_sync_policy(sync, bypass && sync_batch == 0 ? 32 * 1024 * 1024 : sync_batch);
+
+        // Segments to an HTTP/2 origin can share one connection as streams;
+        // whether that beats separate connections is measured per origin
+        std::optional<Transport> mode;
+        if (split && info.multiplexed && transport != "connections") {
+            mode = transport == "multiplex" ? Transport::MULTIPLEX : transports_.choose(entry->origin);
+            if (*mode == Transport::MULTIPLEX) downloader->set_multiplexer(&multiplexer_);
+            spdlog::info("download {}: segmentos em {}", entry_id,
+                         *mode == Transport::MULTIPLEX ? "streams HTTP/2" : "conexoes separadas");
+        }
+        if (extractor) downloader->set_extractor(extractor.get(), keep_archive);
+
+        auto adapter = std::make_unique<DownloadObserverAdapter>(entry_id, callback);
+        downloader->add_observer(adapter.get());
+
+        {
+            std::lock_guard lock(mutex_);
+            running_[entry_id] = downloader.get();
+            if (stop_requests_.count(entry_id)) downloader->cancel();
+        }
+
+        DownloadOptions options{info.url, output_path, info.content_size, entry_id, info.validator};
+        const auto started = std::chrono::steady_clock::now();
+        {
+            trace::Span span("download", "download");
+            downloader->download(options);
+        }
+
+        if (mode) {
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            std::lock_guard lock(mutex_);
+            if (entry->status == FINISHED && seconds > 0.0) {
+                transports_.record(entry->origin, *mode, static_cast<double>(info.content_size) / seconds);
+            }
+        }
+
+        if (extractor && !keep_archive && split) {
+            std::lock_guard lock(mutex_);
+            if (entry->status == FINISHED) {
+                std::error_code ec;
+                fs::remove(output_path, ec);
+            }
+        }
+
+        {
+            // Under the lock, so a resume can't preallocate a new .part first
+            std::lock_guard lock(mutex_);
+            if (entry->status == CANCELLED) discard_part(output_path);
+        }
+
+        std::lock_guard lock(mutex_);
+        if (auto it = running_.find(entry_id); it != running_.end() && it->second == downloader.get()) {
+            running_.erase(it);
+        }
+        finished_runs_.push_back(run);
+        // The entry may have been held back from pruning while this ran
+        prune_finished();
+    }));
+}
+
+void DownloadEngine::on_download_event(int download_id, const DownloadEvent& event) {
+    std::lock_guard lock(mutex_);
+
+    DownloadEntry* entry = find(download_id);
+    if (!entry) return;
+
+    if (event.thread_id >= 0) {
+        auto& ts = entry->threads[event.thread_id];
+        ts.status = event.status;
+        ts.bytes_downloaded = event.bytes_downloaded;
+        ts.total_bytes = event.total_bytes;
+        ts.elapsed_seconds = event.elapsed_seconds;
+        ts.retries = event.retries;
+    }
+
+    // Segment events only drive progress; the download's own events (thread_id
+    // < 0) decide its lifecycle, so a finished segment never frees its slot.
+    if (event.thread_id >= 0 && entry->status == STARTED && event.status == RUNNING) {
+        entry->status = RUNNING;
+    }
+    entry->elapsed_seconds = event.elapsed_seconds;
+
+    size_t total_downloaded = 0;
+    for (const auto& [tid, ts] : entry->threads) {
+        total_downloaded += ts.bytes_downloaded;
+    }
+    entry->bytes_downloaded = total_downloaded;
+
+    if (event.thread_id < 0 &&
+        (event.status == FINISHED || event.status == FAILED || event.status == CANCELLED)) {
+        SPDLOG_DEBUG("evento: id={} status={} thread={}", download_id,
+            static_cast<int>(event.status), event.thread_id);
+
+        DownloadStatus status = event.status;
+        if (auto it = stop_requests_.find(download_id); it != stop_requests_.end()) {
+            if (status == CANCELLED) status = it->second;
+            stop_requests_.erase(it);
+        }
+        settle(entry, status);
+    } else {
+        if (event.thread_id < 0) entry->status = event.status;
+        touch(entry);
+        metrics_.record(*entry, event);
+    }
+
+    notify();
+}
+
+void DownloadEngine::on_probed(const std::string& url, const PreDownloadInfo& info) {
+    std::lock_guard lock(mutex_);
+    if (learn(url, info)) notify();
+}
+
+// Fills in what the queue shows and sorts by before an entry is admitted.
+// Sizes reach the scheduler only through here, so SEF ordering depends on
+// a HEAD of the URL: the prober's, or an earlier admission's.
+bool DownloadEngine::learn(const std::string& url, const PreDownloadInfo& info) {
+    if (info.filename.empty()) return false; // the HEAD failed; admission retries it
+    auto it = pending_by_url_.find(url);
+    if (it == pending_by_url_.end()) return false;
+    for (const int id : it->second) {
+        DownloadEntry* d = entries_by_id_.at(id);
+        d->filename = info.filename;
+        d->content_size = info.content_size;
+        d->accept_ranges = info.accept_ranges;
+        touch(d);
+        scheduler_.update_size(id, info.content_size);
+    }
+    return true;
+}
+
+void DownloadEngine::unindex_pending(const DownloadEntry* entry) {
+    auto it = pending_by_url_.find(entry->url);
+    if (it == pending_by_url_.end()) return;
+    std::erase(it->second, entry->id);
+    if (it->second.empty()) pending_by_url_.erase(it);
+}
+
+void DownloadEngine::settle(DownloadEntry* entry, DownloadStatus status) {
+    entry->status = status;
+    touch(entry);
+
+    DownloadEvent event{status, entry->bytes_downloaded, entry->content_size, entry->elapsed_seconds};
+    metrics_.record(*entry, event);
+
+    scheduler_.release(entry->id);
+    if (status != PAUSED) retire(entry->id);
+    try_start_queued();
+}
+
+void DownloadEngine::retire(int id) {
+    const uint64_t seq = next_retired_++;
+    retired_[id] = seq;
+    retired_order_.emplace_back(seq, id);
+    prune_finished();
+}
+
+// Drops the oldest ended entries beyond keep_finished. Entries whose
+// download thread still runs are kept for now: the thread reads them after
+// the download settles, and prunes again once it returns.
+void DownloadEngine::prune_finished() {
+    if (config_.keep_finished <= 0) return;
+    const size_t limit = static_cast<size_t>(config_.keep_finished);
+
+    std::vector<std::pair<uint64_t, int>> busy;
+    std::unordered_set<int> dropped;
+    while (retired_.size() > limit + busy.size() && !retired_order_.empty()) {
+        const auto [seq, id] = retired_order_.front();
+        retired_order_.pop_front();
+        auto it = retired_.find(id);
+        if (it == retired_.end() || it->second != seq) continue;
+        if (running_.count(id)) {
+            busy.emplace_back(seq, id);
+            continue;
+        }
+        retired_.erase(it);
+        entries_by_id_.erase(id);
+        dropped.insert(id);
+    }
+    retired_order_.insert(retired_order_.begin(), busy.begin(), busy.end());
+
+    if (dropped.empty()) return;
+    std::erase_if(downloads_, [&](const auto& d) { return dropped.count(d->id) > 0; });
+}
+
+void DownloadEngine::try_start_queued() {
+    reap_threads();
+    if (!accepting_) return;
+
+    for (const int id : scheduler_.admit()) {
+        DownloadEntry* entry = entries_by_id_[id];
+        unindex_pending(entry);
+        entry->status = STARTED;
+        touch(entry);
+        start_download(entry);
+    }
+    metrics_.set_queue_depth(scheduler_.queued());
+}
+
+// Joins download threads that already returned so a long-lived daemon
+// doesn't accumulate one std::thread per job ever run.
+void DownloadEngine::reap_threads() {
+    for (const uint64_t run : finished_runs_) {
+        auto it = threads_.find(run);
+        if (it == threads_.end()) continue;
+        // The thread pushed its id as its last locked step; joining it
+        // only waits for the stack to unwind.
+        if (it->second.get_id() != std::this_thread::get_id()) {
+            it->second.join();
+            threads_.erase(it);
+        }
+    }
+    finished_runs_.erase(
+        std::remove_if(finished_runs_.begin(), finished_runs_.end(),
+                       [&](uint64_t run) { return !threads_.count(run); }),
+        finished_runs_.end());
+}
@@ -0,0 +1,616 @@
+#include "extractor.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <spdlog/spdlog.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t CHUNK_SIZE = 256 * 1024;
+constexpr size_t MAX_QUEUED_BYTES = 16 * 1024 * 1024;
+constexpr size_t TAR_BLOCK = 512;
+
+using Sink = std::function<bool(const char *, size_t)>;
+
+bool ends_with(const std::string &s, const std::string &suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Passes decompressed blocks to a sink; end() flushes at end of input and
+// reports whether the compressed stream was complete.
+class Decoder {
+public:
+    virtual ~Decoder() = default;
+    virtual bool decode(const char *data, size_t size, const Sink &out) = 0;
+    virtual bool end(const Sink &out) = 0;
+};
+
+class Identity : public Decoder {
+public:
+    bool decode(const char *data, size_t size, const Sink &out) override { return out(data, size); }
+    bool end(const Sink &) override { return true; }
+};
+
+#ifdef HAVE_ZLIB
+class Gzip : public Decoder {
+    z_stream zs_{};
+    bool done_ = false;
+    std::vector<char> out_ = std::vector<char>(CHUNK_SIZE);
+public:
+    Gzip() { inflateInit2(&zs_, 15 + 32); }
+    ~Gzip() override { inflateEnd(&zs_); }
+
+    bool decode(const char *data, size_t size, const Sink &out) override {
+        zs_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zs_.avail_in = static_cast<uInt>(size);
+        while (zs_.avail_in > 0) {
+            // Concatenated members (pigz, appended logs) form one stream
+            if (done_) {
+                inflateReset(&zs_);
+                done_ = false;
+            }
+            zs_.next_out = reinterpret_cast<Bytef *>(out_.data());
+            zs_.avail_out = static_cast<uInt>(out_.size());
+            const int rc = inflate(&zs_, Z_NO_FLUSH);
+            if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                spdlog::error("gzip: {}", zs_.msg ? zs_.msg : "dados corrompidos");
+                return false;
+            }
+            const size_t produced = out_.size() - zs_.avail_out;
+            if (produced > 0 && !out(out_.data(), produced)) return false;
+            if (rc == Z_STREAM_END) done_ = true;
+            else if (rc == Z_BUF_ERROR && produced == 0) break;
+        }
+        return true;
+    }
+
+    bool end(const Sink &) override { return done_; }
+};
+#endif
+
+#ifdef HAVE_ZSTD
+class Zstd : public Decoder {
+    ZSTD_DStream *ds_ = ZSTD_createDStream();
+    size_t last_ = 0; // 0 once the last frame is complete
+    std::vector<char> out_ = std::vector<char>(ZSTD_DStreamOutSize());
+public:
+    Zstd() { ZSTD_initDStream(ds_); }
+    ~Zstd() override { ZSTD_freeDStream(ds_); }
+
+    bool decode(const char *data, size_t size, const Sink &out) override {
+        ZSTD_inBuffer in{data, size, 0};
+        while (in.pos < in.size) {
+            ZSTD_outBuffer ob{out_.data(), out_.size(), 0};
+            last_ = ZSTD_decompressStream(ds_, &ob, &in);
+            if (ZSTD_isError(last_)) {
+                spdlog::error("zstd: {}", ZSTD_getErrorName(last_));
+                return false;
+            }
+            if (ob.pos > 0 && !out(out_.data(), ob.pos)) return false;
+        }
+        return flush(out);
+    }
+
+    bool end(const Sink &out) override { return flush(out) && last_ == 0; }
+
+private:
+    // Output still buffered inside the decoder after the input ran out
+    bool flush(const Sink &out) {
+        while (true) {
+            ZSTD_inBuffer in{nullptr, 0, 0};
+            ZSTD_outBuffer ob{out_.data(), out_.size(), 0};
+            const size_t rc = ZSTD_decompressStream(ds_, &ob, &in);
+            if (ZSTD_isError(rc)) return false;
+            if (ob.pos > 0 && !out(out_.data(), ob.pos)) return false;
+            if (ob.pos < ob.size) return true;
+        }
+    }
+};
+#endif
+
+#ifdef HAVE_LZMA
+class Xz : public Decoder {
+    lzma_stream strm_ = LZMA_STREAM_INIT;
+    bool ready_ = false;
+    bool done_ = false;
+    std::vector<char> out_ = std::vector<char>(CHUNK_SIZE);
+public:
+    Xz() { ready_ = lzma_stream_decoder(&strm_, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK; }
+    ~Xz() override { lzma_end(&strm_); }
+
+    bool decode(const char *data, size_t size, const Sink &out) override {
+        strm_.next_in = reinterpret_cast<const uint8_t *>(data);
+        strm_.avail_in = size;
+        return run(LZMA_RUN, out);
+    }
+
+    bool end(const Sink &out) override { return run(LZMA_FINISH, out) && done_; }
+
+private:
+    bool run(lzma_action action, const Sink &out) {
+        if (!ready_) return false;
+        while (!done_) {
+            strm_.next_out = reinterpret_cast<uint8_t *>(out_.data());
+            strm_.avail_out = out_.size();
+            const lzma_ret rc = lzma_code(&strm_, action);
+            if (rc != LZMA_OK && rc != LZMA_STREAM_END && rc != LZMA_BUF_ERROR) {
+                spdlog::error("xz: erro {}", static_cast<int>(rc));
+                return false;
+            }
+            const size_t produced = out_.size() - strm_.avail_out;
+            if (produced > 0 && !out(out_.data(), produced)) return false;
+            if (rc == LZMA_STREAM_END) done_ = true;
+            if (strm_.avail_in == 0 && produced < out_.size()) break;
+        }
+        return true;
+    }
+};
+#endif
+
+std::unique_ptr<Decoder> make_decoder(Compression compression) {
+    switch (compression) {
+#ifdef HAVE_ZLIB
+        case Compression::GZIP: return std::make_unique<Gzip>();
+#endif
+#ifdef HAVE_ZSTD
+        case Compression::ZSTD: return std::make_unique<Zstd>();
+#endif
+#ifdef HAVE_LZMA
+        case Compression::XZ: return std::make_unique<Xz>();
+#endif
+        case Compression::NONE: return std::make_unique<Identity>();
+        default: return nullptr;
+    }
+}
+
+bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Rejects absolute paths and any ".." component so an archive can't write
+// outside the destination directory.
+bool safe_relative(const std::string &name, fs::path &out) {
+    fs::path path(name);
+    if (name.empty() || path.is_absolute()) return false;
+    fs::path clean;
+    for (const auto &part : path) {
+        if (part == "..") return false;
+        if (part == "." || part.empty()) continue;
+        clean /= part;
+    }
+    out = clean; // empty for the archive root ("./")
+    return true;
+}
+
+class Writer {
+public:
+    virtual ~Writer() = default;
+    virtual bool write(const char *data, size_t size) = 0;
+    virtual bool finish() = 0;
+};
+
+// Decompressed single file (foo.gz -> foo)
+class PlainWriter : public Writer {
+    int fd_ = -1;
+public:
+    explicit PlainWriter(const fs::path &path) {
+        fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) spdlog::error("falha ao criar {}: {}", path.string(), std::strerror(errno));
+    }
+    ~PlainWriter() override {
+        if (fd_ >= 0) close(fd_);
+    }
+    bool write(const char *data, size_t size) override { return fd_ >= 0 && write_all(fd_, data, size); }
+    bool finish() override { return fd_ >= 0; }
+};
+
+// Streaming ustar/GNU/pax reader: regular files, directories and relative
+// symlinks are created under the destination; other entry types are skipped.
+class TarWriter : public Writer {
+    enum class State { HEADER, DATA, META, PADDING, END };
+
+    fs::path dest_;
+    State state_ = State::HEADER;
+    char block_[TAR_BLOCK];
+    size_t filled_ = 0;
+    size_t remaining_ = 0; // entry bytes left in DATA/META
+    size_t padding_ = 0;
+    int fd_ = -1;
+    char meta_type_ = 0;
+    std::string meta_;
+    std::string long_name_;
+    std::string long_link_;
+    int zero_blocks_ = 0;
+    size_t files_ = 0;
+
+    static size_t parse_number(const char *field, size_t size) {
+        // GNU base-256 for sizes beyond 8GB
+        if (static_cast<unsigned char>(field[0]) & 0x80) {
+            size_t value = static_cast<unsigned char>(field[0]) & 0x7f;
+            for (size_t i = 1; i < size; ++i) value = (value << 8) | static_cast<unsigned char>(field[i]);
+            return value;
+        }
+        size_t value = 0;
+        for (size_t i = 0; i < size && field[i]; ++i) {
+            if (field[i] == ' ') continue;
+            if (field[i] < '0' || field[i] > '7') break;
+            value = value * 8 + static_cast<size_t>(field[i] - '0');
+        }
+        return value;
+    }
+
+    static std::string field(const char *data, size_t size) {
+        return std::string(data, strnlen(data, size));
+    }
+
+    // "<len> key=value\n" records; only the path overrides matter here
+    void apply_pax(const std::string &records) {
+        size_t pos = 0;
+        while (pos < records.size()) {
+            const size_t space = records.find(' ', pos);
+            if (space == std::string::npos) return;
+            const size_t len = std::strtoul(records.c_str() + pos, nullptr, 10);
+            if (len == 0 || pos + len > records.size()) return;
+            const std::string record = records.substr(space + 1, pos + len - space - 2);
+            const size_t eq = record.find('=');
+            if (eq != std::string::npos) {
+                const std::string key = record.substr(0, eq);
+                if (key == "path") long_name_ = record.substr(eq + 1);
+                else if (key == "linkpath") long_link_ = record.substr(eq + 1);
+            }
+            pos += len;
+        }
+    }
+
+    bool begin_entry() {
+        const bool zero = std::all_of(block_, block_ + TAR_BLOCK, [](char c) { return c == 0; });
+        if (zero) {
+            if (++zero_blocks_ == 2) state_ = State::END;
+            return true;
+        }
+        zero_blocks_ = 0;
+
+        const size_t size = parse_number(block_ + 124, 12);
+        const char type = block_[156];
+        padding_ = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+        remaining_ = size;
+
+        if (type == 'L' || type == 'K' || type == 'x' || type == 'g') {
+            meta_type_ = type;
+            meta_.clear();
+            state_ = size > 0 ? State::META : (padding_ > 0 ? State::PADDING : State::HEADER);
+            return true;
+        }
+
+        std::string name = long_name_;
+        if (name.empty()) {
+            name = field(block_, 100);
+            if (std::memcmp(block_ + 257, "ustar", 5) == 0 && block_[345]) {
+                name = field(block_ + 345, 155) + "/" + name;
+            }
+        }
+        std::string link = long_link_.empty() ? field(block_ + 157, 100) : long_link_;
+        long_name_.clear();
+        long_link_.clear();
+
+        fs::path rel;
+        const bool safe = safe_relative(name, rel);
+        if (!safe) spdlog::warn("tar: ignorando caminho inseguro {}", name);
+        const fs::path path = dest_ / rel;
+        const auto mode = static_cast<mode_t>(parse_number(block_ + 100, 8) & 0777);
+
+        std::error_code ec;
+        if (safe && rel.empty()) {
+            // "./" itself
+        } else if (safe && (type == '0' || type == '\0' || type == '7')) {
+            fs::create_directories(path.parent_path(), ec);
+            fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode ? mode : 0644);
+            if (fd_ < 0) {
+                spdlog::error("tar: falha ao criar {}: {}", path.string(), std::strerror(errno));
+                return false;
+            }
+            files_++;
+        } else if (safe && type == '5') {
+            fs::create_directories(path, ec);
+        } else if (safe && type == '2') {
+            fs::path target;
+            if (safe_relative(link, target) && !target.empty()) {
+                fs::create_directories(path.parent_path(), ec);
+                fs::remove(path, ec);
+                fs::create_symlink(link, path, ec);
+            } else {
+                spdlog::warn("tar: ignorando link {} -> {}", name, link);
+            }
+        } else if (safe) {
+            SPDLOG_DEBUG("tar: ignorando entrada tipo {} {}", type, name);
+        }
+
+        state_ = size > 0 ? State::DATA : (padding_ > 0 ? State::PADDING : State::HEADER);
+        return true;
+    }
+
+    void end_entry() {
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+        if (state_ == State::META) {
+            if (meta_type_ == 'L') long_name_ = field(meta_.data(), meta_.size());
+            else if (meta_type_ == 'K') long_link_ = field(meta_.data(), meta_.size());
+            else if (meta_type_ == 'x') apply_pax(meta_);
+        }
+        state_ = padding_ > 0 ? State::PADDING : State::HEADER;
+    }
+
+public:
+    explicit TarWriter(fs::path dest) : dest_(std::move(dest)) {}
+    ~TarWriter() override {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool write(const char *data, size_t size) override {
+        while (size > 0) {
+            switch (state_) {
+                case State::END:
+                    return true; // trailing zero padding
+                case State::HEADER: {
+                    const size_t n = std::min(size, TAR_BLOCK - filled_);
+                    std::memcpy(block_ + filled_, data, n);
+                    filled_ += n;
+                    data += n;
+                    size -= n;
+                    if (filled_ == TAR_BLOCK) {
+                        filled_ = 0;
+                        if (!begin_entry()) return false;
+                    }
+                    break;
+                }
+                case State::DATA:
+                case State::META: {
+                    const size_t n = std::min(size, remaining_);
+                    if (state_ == State::META) meta_.append(data, n);
+                    else if (fd_ >= 0 && !write_all(fd_, data, n)) return false;
+                    data += n;
+                    size -= n;
+                    remaining_ -= n;
+                    if (remaining_ == 0) end_entry();
+                    break;
+                }
+                case State::PADDING: {
+                    const size_t n = std::min(size, padding_);
+                    data += n;
+                    size -= n;
+                    padding_ -= n;
+                    if (padding_ == 0) state_ = State::HEADER;
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool finish() override {
+        spdlog::info("tar: {} arquivos extraidos em {}", files_, dest_.string());
+        // Some writers omit the end-of-archive blocks; a clean boundary is enough
+        return state_ == State::END || (state_ == State::HEADER && filled_ == 0);
+    }
+};
+
+} // namespace
+
+ArchiveFormat ArchiveFormat::detect(const std::string &filename) {
+    std::string name = filename;
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    static const struct {
+        const char *suffix;
+        Compression compression;
+        bool tar;
+    } known[] = {
+        {".tar.gz", Compression::GZIP, true},  {".tgz", Compression::GZIP, true},
+        {".tar.zst", Compression::ZSTD, true}, {".tzst", Compression::ZSTD, true},
+        {".tar.xz", Compression::XZ, true},    {".txz", Compression::XZ, true},
+        {".tar", Compression::NONE, true},     {".gz", Compression::GZIP, false},
+        {".zst", Compression::ZSTD, false},    {".xz", Compression::XZ, false},
+    };
+
+    ArchiveFormat format;
+    for (const auto &k : known) {
+        if (ends_with(name, k.suffix)) {
+            format.compression = k.compression;
+            format.tar = k.tar;
+            format.stem = filename.substr(0, filename.size() - std::strlen(k.suffix));
+            break;
+        }
+    }
+    return format;
+}
+
+bool ArchiveFormat::supported() const {
+    switch (compression) {
+        case Compression::NONE: return tar;
+#ifdef HAVE_ZLIB
+        case Compression::GZIP: return true;
+#endif
+#ifdef HAVE_ZSTD
+        case Compression::ZSTD: return true;
+#endif
+#ifdef HAVE_LZMA
+        case Compression::XZ: return true;
+#endif
+        default: return false;
+    }
+}
+
+StreamExtractor::StreamExtractor(ArchiveFormat format, std::string dest_dir)
+    : format_(std::move(format)), dest_dir_(std::move(dest_dir)) {}
+
+StreamExtractor::~StreamExtractor() {
+    abort();
+    if (worker_.joinable()) worker_.join();
+    if (follow_fd_ >= 0) close(follow_fd_);
+}
+
+void StreamExtractor::start() {
+    worker_ = std::thread(&StreamExtractor::run, this);
+}
+
+bool StreamExtractor::feed(const char *data, size_t size) {
+    std::unique_lock lock(mutex_);
+    changed_.wait(lock, [&] { return queued_bytes_ < MAX_QUEUED_BYTES || aborted_ || failed_; });
+    if (aborted_ || failed_) return false;
+    chunks_.emplace_back(data, data + size);
+    queued_bytes_ += size;
+    changed_.notify_all();
+    return true;
+}
+
+void StreamExtractor::follow(const std::string &path) {
+    std::lock_guard lock(mutex_);
+    follow_fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (follow_fd_ < 0) {
+        spdlog::error("extracao: falha ao abrir {}: {}", path, std::strerror(errno));
+        failed_ = true;
+    }
+}
+
+void StreamExtractor::advance(size_t frontier) {
+    std::lock_guard lock(mutex_);
+    if (frontier > frontier_) {
+        frontier_ = frontier;
+        changed_.notify_all();
+    }
+}
+
+bool StreamExtractor::finish() {
+    {
+        std::lock_guard lock(mutex_);
+        eof_ = true;
+        changed_.notify_all();
+    }
+    if (worker_.joinable()) worker_.join();
+    return !failed_ && !aborted_;
+}
+
+void StreamExtractor::abort() {
+    std::lock_guard lock(mutex_);
+    aborted_ = true;
+    changed_.notify_all();
+}
+
+// Blocks until input is available; false at end of input or on abort
+bool StreamExtractor::next_input(std::vector<char> &buffer) {
+    std::unique_lock lock(mutex_);
+
+    while (true) {
+        if (aborted_) return false;
+        if (!chunks_.empty()) {
+            buffer = std::move(chunks_.front());
+            chunks_.pop_front();
+            queued_bytes_ -= buffer.size();
+            changed_.notify_all();
+            return true;
+        }
+        if (follow_fd_ >= 0 && consumed_ < frontier_) {
+            const size_t n = std::min(CHUNK_SIZE, frontier_ - consumed_);
+            const int fd = follow_fd_;
+            const auto offset = static_cast<off_t>(consumed_);
+            lock.unlock();
+            buffer.resize(n);
+            const ssize_t got = pread(fd, buffer.data(), n, offset);
+            lock.lock();
+            if (got <= 0) {
+                if (got < 0 && errno == EINTR) continue;
+                spdlog::error("extracao: falha ao ler o arquivo parcial: {}", std::strerror(errno));
+                failed_ = true;
+                changed_.notify_all();
+                return false;
+            }
+            buffer.resize(static_cast<size_t>(got));
+            consumed_ += static_cast<size_t>(got);
+            return true;
+        }
+        if (eof_) return false;
+        changed_.wait(lock);
+    }
+}
+
+void StreamExtractor::run() {
+    const auto start = std::chrono::steady_clock::now();
+    auto fail = [&](const std::string &reason) {
+        {
+            std::lock_guard lock(mutex_);
+            error_ = reason;
+            failed_ = true;
+        }
+        changed_.notify_all();
+        spdlog::error("extracao falhou: {}", reason);
+    };
+
+    std::error_code ec;
+    fs::create_directories(dest_dir_, ec);
+
+    auto decoder = make_decoder(format_.compression);
+    if (!decoder) {
+        fail("formato nao suportado nesta compilacao");
+        return;
+    }
+
+    std::unique_ptr<Writer> writer;
+    if (format_.tar) writer = std::make_unique<TarWriter>(dest_dir_);
+    else writer = std::make_unique<PlainWriter>(fs::path(dest_dir_) / format_.stem);
+
+    size_t in_bytes = 0, out_bytes = 0;
+    const Sink sink = [&](const char *data, size_t size) {
+        out_bytes += size;
+        return writer->write(data, size);
+    };
+
+    std::vector<char> buffer;
+    while (next_input(buffer)) {
+        in_bytes += buffer.size();
+        if (!decoder->decode(buffer.data(), buffer.size(), sink)) {
+            fail("dados invalidos");
+            return;
+        }
+    }
+    if (aborted_ || failed_) return;
+
+    if (!decoder->end(sink)) {
+        fail("fluxo comprimido incompleto");
+        return;
+    }
+    if (!writer->finish()) {
+        fail("arquivo tar incompleto");
+        return;
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("extracao concluida: {} -> {} bytes em {:.1f}s ({})", in_bytes, out_bytes, elapsed, dest_dir_);
+}
@@ -0,0 +1,65 @@
+#include "hedge_planner.h"
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+std::vector<size_t> HedgePlanner::pick(const std::vector<HedgeSample> &samples, size_t total, size_t duplicated) const {
+	std::vector<size_t> result;
+	if (!enabled() || total == 0 || exhausted(duplicated, total))
+		return result;
+
+	size_t remaining = 0;
+	int racing = 0;
+	for (const auto &s : samples) {
+		remaining += s.remaining;
+		if (s.hedged && s.remaining > 0)
+			racing++;
+	}
+	const double done = 1.0 - static_cast<double>(remaining) / static_cast<double>(total);
+	if (done < policy_.start_fraction || racing >= policy_.max_hedges)
+		return result;
+
+	// Finished segments count too: they are what the stragglers fell behind
+	std::vector<double> averages;
+	for (const auto &s : samples) {
+		if (s.average > 0.0)
+			averages.push_back(s.average);
+	}
+	if (averages.empty())
+		return result;
+	auto mid = averages.begin() + static_cast<std::ptrdiff_t>(averages.size() / 2);
+	std::nth_element(averages.begin(), mid, averages.end());
+	const double reference = *mid;
+
+	std::vector<std::pair<double, size_t>> candidates; // (expected seconds left, index)
+	for (size_t i = 0; i < samples.size(); ++i) {
+		const auto &s = samples[i];
+		if (!s.active || s.hedged || s.remaining < policy_.min_remaining || s.rate >= reference * policy_.slow_ratio)
+			continue;
+		const double eta = s.rate > 0.0 ? static_cast<double>(s.remaining) / s.rate
+		                                : std::numeric_limits<double>::infinity();
+		candidates.emplace_back(eta, i);
+	}
+	std::sort(candidates.begin(), candidates.end(), std::greater<>());
+
+	// While a hedge at the reference rate fetches the tail, the straggler
+	// fetches its own share of it again
+	const double budget = policy_.budget * static_cast<double>(total);
+	double planned = static_cast<double>(duplicated);
+	for (const auto &[eta, i] : candidates) {
+		if (racing >= policy_.max_hedges)
+			break;
+		const double expected = static_cast<double>(samples[i].remaining) * samples[i].rate / reference;
+		if (planned + expected > budget)
+			continue;
+		planned += expected;
+		racing++;
+		result.push_back(i);
+	}
+
+	return result;
+}
+
+bool HedgePlanner::exhausted(size_t duplicated, size_t total) const {
+	return static_cast<double>(duplicated) >= policy_.budget * static_cast<double>(total);
+}
@@ -5,9 +5,37 @@
 
 struct AppConfig {
     int max_connections = 8;
+    int max_connections_per_host = 8;  // shared by all downloads of a host:port
+    int max_total_connections = 32;    // across every active download
     int max_downloads = 3;
+    int max_downloads_per_host = 0;  // 0 = no per-host cap
+    std::string scheduling = "fifo"; // fifo | sef (shortest expected first, sized by HEAD)
+    int keep_finished = 1000;     // finished/failed/cancelled entries kept listed; 0 = all
     int max_retries = 3;
+    int stall_window = 5;         // seconds per stall-detection window
+    int stall_min_speed = 16384;  // bytes/s below which a connection is stalled
+    int hedge_budget_pct = 5;     // extra bytes hedged tails may fetch, % of the file; 0 = off
+    int hedge_start_pct = 75;     // % of the file done before tails get hedged
+    int hedge_max = 2;            // hedges racing at once per download
+    bool hedge_other_address = true; // hedge to another resolved address of the host
+    int probe_concurrency = 4;    // background HEADs for queued entries; 0 = probe on admission
+    int probe_ttl = 300;          // seconds a probe result stays usable
+    std::string transport = "auto"; // auto | multiplex | connections, for HTTP/2 origins
+    int multiplex_connections = 1;  // connections per host carrying multiplexed segments
+    bool native_http = false;       // splice-based HTTP/1.1 client for plain-http segments
     std::string output_dir = ".";
+    std::string sync = "batch";    // none | finish (fsync before rename) | batch (+ writeback while downloading)
+    int sync_batch_mb = 32;        // MB written between writeback kicks under batch
+    std::string cache_mode = "normal"; // normal | dontneed | direct (O_DIRECT), for large files
+    int cache_bypass_min_mb = 1024;    // files at least this big use cache_mode
+    bool extract = false;          // unpack .tar.gz/.tar.zst/.tar.xz/... while downloading
+    std::string extract_dir;       // empty = output_dir
+    bool keep_archive = true;      // false = drop the archive once extracted
+    std::string log_level = "info";
+    std::string socket_path;       // empty = $XDG_RUNTIME_DIR/cdownload.sock
+    int metrics_port = 0;          // 0 = no HTTP endpoint
+    std::string metrics_file;      // empty = no textfile export
+    int metrics_interval = 10;     // seconds between metrics_file rewrites
 
     static AppConfig load();
     void save() const;
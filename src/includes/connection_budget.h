@@ -0,0 +1,89 @@
+#ifndef CDOWNLOAD_MANAGER_CONNECTION_BUDGET_H
+#define CDOWNLOAD_MANAGER_CONNECTION_BUDGET_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Connection slots shared by every active download, capped globally and per
+// origin (host:port). Segment workers hold a lease for as long as they keep a
+// connection open; waiters on the same origin are served in arrival order.
+// Multiplexed streams share slots, one per connection carrying them.
+class ConnectionBudget {
+public:
+    class Lease {
+        ConnectionBudget *budget_ = nullptr;
+        std::string origin_;
+        int connections_ = 0; // > 0 for a stream lease, see acquire_stream
+    public:
+        Lease() = default;
+        Lease(ConnectionBudget *budget, std::string origin, int connections = 0)
+            : budget_(budget), origin_(std::move(origin)), connections_(connections) {}
+        Lease(Lease &&other) noexcept
+            : budget_(other.budget_), origin_(std::move(other.origin_)), connections_(other.connections_) {
+            other.budget_ = nullptr;
+        }
+        Lease &operator=(Lease &&other) noexcept;
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+        ~Lease() { release(); }
+
+        explicit operator bool() const { return budget_ != nullptr; }
+        void release();
+    };
+
+    ConnectionBudget(int max_total, int max_per_origin)
+        : max_total_(max_total), max_per_origin_(max_per_origin) {}
+
+    void set_limits(int max_total, int max_per_origin);
+
+    // Blocks until both the origin and the global budget have a free slot.
+    // Returns an empty lease if `cancelled` becomes true while waiting.
+    Lease acquire(const std::string &origin, const std::atomic<bool> *cancelled = nullptr);
+
+    // A stream on one of up to `connections` multiplexed connections to the
+    // origin. The first stream waits for a slot as acquire() does; later
+    // ones take another slot only if one is free right away, and otherwise
+    // share the connections already counted. Slots are given back as the
+    // streams drain.
+    Lease acquire_stream(const std::string &origin, int connections,
+                         const std::atomic<bool> *cancelled = nullptr);
+
+    // Global slots nobody holds or waits for; INT_MAX when uncapped.
+    int idle_connections() const;
+    // Slots one origin may hold; 0 when uncapped
+    int per_origin_limit() const;
+
+private:
+    struct OriginState {
+        int in_use = 0;
+        std::deque<uint64_t> waiters; // tickets in arrival order
+        int streams = 0;      // stream leases held
+        int stream_slots = 0; // part of in_use held on their behalf
+    };
+
+    enum class Turn { SLOT, SHARED, CANCELLED };
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    int max_total_;
+    int max_per_origin_;
+    int in_use_ = 0;
+    int waiting_ = 0;
+    uint64_t next_ticket_ = 0;
+    std::unordered_map<std::string, OriginState> origins_;
+
+    bool slot_free(const OriginState &state) const;
+    // Queues for a slot; with `shared`, stops waiting as soon as another
+    // stream of the origin holds one
+    Turn wait_turn(std::unique_lock<std::mutex> &lock, OriginState &state,
+                   const std::atomic<bool> *cancelled, bool shared);
+    void forget_if_idle(const std::string &origin);
+    void release(const std::string &origin, int connections);
+};
+
+#endif // CDOWNLOAD_MANAGER_CONNECTION_BUDGET_H
@@ -1,6 +1,9 @@
 #ifndef CDOWNLOAD_MANAGER_CONSTANTS_H
 #define CDOWNLOAD_MANAGER_CONSTANTS_H
+#include <cstddef>
 namespace constants {
     constexpr int MAX_CONNECTIONS = 8;
+    constexpr size_t LOG_QUEUE_SIZE = 8192;
+    constexpr size_t MIN_SPLIT_SIZE = 5 * 1024 * 1024; // 5MB
 }
 #endif //CONSTANTS_H
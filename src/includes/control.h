@@ -0,0 +1,133 @@
+#ifndef CDOWNLOAD_MANAGER_CONTROL_H
+#define CDOWNLOAD_MANAGER_CONTROL_H
+
+#include "engine.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Line protocol spoken over the daemon's Unix-domain socket. Every request is
+// one tab-separated line; replies are "ok[\t<value>]" or "err\t<message>",
+// except list/watch which send E/T entry lines terminated by "end":
+//
+//   enqueue <url> <output_dir> <priority>   -> ok <id>
+//   priority <id> <priority> | pause <id> | resume <id> | cancel <id>
+//   limits <max_connections> <max_downloads> <max_retries>
+//   list                                    -> E/T lines, end
+//   watch                                   -> batches of changed E/T lines and R <id> lines for
+//                                              pruned entries, each followed by end
+//   shutdown
+namespace control {
+    std::string default_socket_path();
+
+    std::vector<std::string> split(const std::string& line);
+    // Makes a value safe to embed as one field of a line
+    std::string field(const std::string& value);
+
+    std::string encode_entry(const DownloadEntry& entry);
+    // Applies an E, T or R line to `entries`; returns the touched entry id or -1
+    int apply_line(const std::string& line, DownloadService::Entries& entries,
+                   std::unordered_map<int, DownloadEntry*>& by_id);
+
+    // Buffered line reader/writer over a connected socket
+    class LineSocket {
+        int fd_ = -1;
+        std::string buffer_;
+    public:
+        LineSocket() = default;
+        explicit LineSocket(int fd) : fd_(fd) {}
+        LineSocket(LineSocket&& other) noexcept : fd_(other.fd_), buffer_(std::move(other.buffer_)) { other.fd_ = -1; }
+        LineSocket& operator=(LineSocket&& other) noexcept;
+        LineSocket(const LineSocket&) = delete;
+        LineSocket& operator=(const LineSocket&) = delete;
+        ~LineSocket() { close(); }
+
+        static LineSocket connect(const std::string& path);
+
+        int fd() const { return fd_; }
+        bool is_open() const { return fd_ >= 0; }
+        void close();
+        // Waits up to timeout_ms (-1 = forever); nullopt on timeout, EOF or error
+        std::optional<std::string> read_line(int timeout_ms = -1);
+        bool write_line(const std::string& line);
+    };
+}
+
+// Serves a DownloadService on a Unix-domain socket, one thread per client.
+class ControlServer {
+public:
+    ControlServer(DownloadService& service, AppConfig config, std::string path)
+        : service_(service), config_(std::move(config)), path_(std::move(path)) {}
+    ~ControlServer();
+
+    bool listen();
+    // Accepts clients until `stop` is set or a client sends "shutdown"
+    void run(const std::atomic<bool>& stop);
+
+private:
+    DownloadService& service_;
+    std::mutex config_mutex_;
+    AppConfig config_;
+    std::string path_;
+    int listen_fd_ = -1;
+    std::atomic<bool> shutdown_{false};
+
+    std::mutex clients_mutex_;
+    uint64_t next_client_ = 0;
+    std::unordered_map<uint64_t, std::thread> client_threads_;
+    std::vector<uint64_t> finished_clients_;
+    std::vector<int> client_fds_;
+
+    void serve(uint64_t client, control::LineSocket socket);
+    std::string handle(const std::vector<std::string>& args);
+    void stream(control::LineSocket& socket);
+    void list(control::LineSocket& socket);
+};
+
+// DownloadService backed by a running daemon. Commands are synchronous
+// round trips; a second connection keeps a local mirror of the queue fresh.
+class DaemonClient : public DownloadService {
+public:
+    explicit DaemonClient(std::string path) : path_(std::move(path)) {}
+    ~DaemonClient() override;
+
+    bool connect();
+    // Starts mirroring the daemon's entries for read()
+    void watch();
+    // Sends one request line; returns the reply lines (up to "end" for list)
+    std::vector<std::string> request(const std::string& line);
+
+    int enqueue(const std::string& url, const std::string& output_dir,
+                DownloadPriority priority = PRIORITY_NORMAL) override;
+    bool set_priority(int id, DownloadPriority priority) override;
+    bool pause(int id) override;
+    bool resume(int id) override;
+    bool cancel(int id) override;
+    void apply_config(const AppConfig& config) override;
+    void read(const std::function<void(const Entries&)>& fn) override;
+    void set_on_change(std::function<void()> callback) override;
+    bool is_remote() const override { return true; }
+
+private:
+    std::string path_;
+    std::mutex command_mutex_;
+    control::LineSocket command_;
+
+    std::mutex mirror_mutex_;
+    Entries mirror_;
+    std::unordered_map<int, DownloadEntry*> mirror_by_id_;
+    std::function<void()> on_change_;
+
+    std::atomic<bool> watching_{false};
+    std::thread watch_thread_;
+
+    bool simple(const std::string& line);
+};
+
+#endif // CDOWNLOAD_MANAGER_CONTROL_H
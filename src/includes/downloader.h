@@ -1,17 +1,89 @@
 #ifndef CDOWNLOAD_MANAGER_DOWNLOADER_H
 #define CDOWNLOAD_MANAGER_DOWNLOADER_H
 
+#include "connection_budget.h"
+#include "extractor.h"
+#include "hedge_planner.h"
 #include "observer.h"
+#include "stall_detector.h"
 #include "structs.h"
+#include "write_back.h"
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
+class Multiplexer;
+
 class DefaultDownloader : public IProducer<DownloadEvent> {
     std::vector<IObserver<DownloadEvent>*> observers;
+    ConnectionBudget* budget = nullptr;
+protected:
+    std::atomic<bool> cancelled{false};
+    StreamExtractor* extractor = nullptr;
+    bool keep_archive = true;
+    Multiplexer* multiplexer = nullptr;
+    SyncPolicy sync_policy = SyncPolicy::BATCH;
+    size_t sync_batch = 0;
+    CacheMode cache_mode = CacheMode::NORMAL;
+    bool use_native_http = false;
+
+    bool is_cancelled() const { return cancelled.load(); }
+    // Holds one of the origin's connection slots; a no-op without a budget.
+    // Waiting gives up once `stop` (by default the cancel flag) is set. A
+    // stream on the multiplexer shares its slot with the origin's other
+    // streams (ConnectionBudget::acquire_stream).
+    ConnectionBudget::Lease acquire_connection(const std::string &url,
+                                               const std::atomic<bool> *stop = nullptr,
+                                               bool stream = false);
+    // max_connections_per_host, or 0 without a budget or cap
+    int per_origin_connections() const {
+        return budget ? budget->per_origin_limit() : 0;
+    }
 public:
     virtual ~DefaultDownloader() = default;
     virtual void download(const DownloadOptions &options) = 0;
 
+    void set_connection_budget(ConnectionBudget* shared) {
+        budget = shared;
+    }
+
+    // Sends segment requests as streams over the multiplexer's connections
+    // instead of opening one connection per segment
+    void set_multiplexer(Multiplexer* shared) {
+        multiplexer = shared;
+    }
+
+    // Bytes go to part_path(out) and are renamed to `out` right before
+    // FINISHED, after being synced as `policy` says
+    void set_sync_policy(SyncPolicy policy, size_t batch) {
+        sync_policy = policy;
+        sync_batch = batch;
+    }
+
+    // Keeps a large download from evicting everything else's page cache
+    void set_cache_mode(CacheMode mode) {
+        cache_mode = mode;
+    }
+
+    // Plain-http segments use the splice-based client in native_http.h,
+    // falling back to libcurl per segment for anything it doesn't handle
+    void set_native_http(bool enabled) {
+        use_native_http = enabled;
+    }
+
+    // Streams the bytes into a started extractor as they arrive; FINISHED is
+    // only emitted once extraction succeeded. Without keep, a single stream
+    // is never written to `out`.
+    void set_extractor(StreamExtractor* stage, bool keep) {
+        extractor = stage;
+        keep_archive = keep;
+    }
+
+    // Stops the transfer from any thread; download() then emits CANCELLED
+    void cancel() {
+        cancelled = true;
+    }
+
     void add_observer(IObserver<DownloadEvent>* listener) override {
         observers.push_back(listener);
     }
@@ -37,8 +109,13 @@ public:
 
 class ParalellDownloader : public DefaultDownloader {
     int thread_count;
+    int max_retries;
+    StallDetector stall_detector;
+    HedgePlanner hedge_planner;
 public:
-    ParalellDownloader(const int threads): thread_count(threads) {};
+    ParalellDownloader(const int threads, const int retries = 3, const StallPolicy &stall = {},
+                       const HedgePolicy &hedge = {})
+        : thread_count(threads), max_retries(retries), stall_detector(stall), hedge_planner(hedge) {};
     void download(const DownloadOptions &options) override;
 };
 
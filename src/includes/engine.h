@@ -0,0 +1,139 @@
+#ifndef CDOWNLOAD_MANAGER_ENGINE_H
+#define CDOWNLOAD_MANAGER_ENGINE_H
+
+#include "config.h"
+#include "connection_budget.h"
+#include "metrics.h"
+#include "multiplexer.h"
+#include "observer.h"
+#include "prober.h"
+#include "scheduler.h"
+#include "structs.h"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class DefaultDownloader;
+
+class DownloadObserverAdapter : public IObserver<DownloadEvent> {
+    int download_id_;
+    std::function<void(int, const DownloadEvent&)> callback_;
+public:
+    DownloadObserverAdapter(int id, std::function<void(int, const DownloadEvent&)> cb)
+        : download_id_(id), callback_(std::move(cb)) {}
+
+    void on_update(const DownloadEvent& event) override {
+        callback_(download_id_, event);
+    }
+};
+
+// What the UI and the control socket need from a download queue, whether it
+// runs in this process (DownloadEngine) or in a daemon (DaemonClient).
+class DownloadService {
+public:
+    using Entries = std::vector<std::unique_ptr<DownloadEntry>>;
+
+    virtual ~DownloadService() = default;
+
+    // Returns the new entry's id, or -1 if it could not be queued
+    virtual int enqueue(const std::string& url, const std::string& output_dir,
+                        DownloadPriority priority = PRIORITY_NORMAL) = 0;
+    virtual bool set_priority(int id, DownloadPriority priority) = 0;
+    virtual bool pause(int id) = 0;
+    virtual bool resume(int id) = 0;
+    virtual bool cancel(int id) = 0;
+    virtual void apply_config(const AppConfig& config) = 0;
+
+    // Calls fn with every entry, in submission order, under the service lock
+    virtual void read(const std::function<void(const Entries&)>& fn) = 0;
+    // Called from worker threads whenever an entry changes
+    virtual void set_on_change(std::function<void()> callback) = 0;
+    // True when downloads keep running after this process exits
+    virtual bool is_remote() const = 0;
+};
+
+// Owns the queue, the scheduler and the worker threads. Lives as long as the
+// TUI in local mode, or for the whole daemon process.
+class DownloadEngine : public DownloadService {
+public:
+    explicit DownloadEngine(AppConfig config);
+    ~DownloadEngine() override;
+
+    void start();
+    // Stops admitting queued entries and waits for running downloads,
+    // cancelling them first when `cancel_running` is set
+    void shutdown(bool cancel_running = false);
+
+    int enqueue(const std::string& url, const std::string& output_dir,
+                DownloadPriority priority = PRIORITY_NORMAL) override;
+    bool set_priority(int id, DownloadPriority priority) override;
+    bool pause(int id) override;
+    bool resume(int id) override;
+    bool cancel(int id) override;
+    void apply_config(const AppConfig& config) override;
+    void read(const std::function<void(const Entries&)>& fn) override;
+    void set_on_change(std::function<void()> callback) override;
+    bool is_remote() const override { return false; }
+
+private:
+    AppConfig config_;
+    std::mutex mutex_;
+    std::function<void()> on_change_;
+    bool accepting_ = true;
+
+    int next_id_ = 0;
+    uint64_t revision_ = 0;
+    Entries downloads_;
+    std::unordered_map<int, DownloadEntry*> entries_by_id_;
+    // PENDING ids per URL, so a probe result doesn't scan every entry
+    std::unordered_map<std::string, std::vector<int>> pending_by_url_;
+    ConnectionBudget budget_;
+    DownloadScheduler scheduler_;
+    MetricsCollector metrics_;
+    Multiplexer multiplexer_;
+    TransportSelector transports_;
+    std::unique_ptr<MetricsExporter> exporter_;
+
+    uint64_t next_run_ = 0;
+    std::unordered_map<uint64_t, std::thread> threads_;
+    std::vector<uint64_t> finished_runs_;
+    std::unordered_map<int, DefaultDownloader*> running_;
+    // PAUSED or CANCELLED, requested while the entry was admitted
+    std::unordered_map<int, DownloadStatus> stop_requests_;
+
+    // Entries that reached FINISHED, FAILED or CANCELLED, oldest first, so
+    // a long-lived daemon only keeps the last keep_finished of them. An id
+    // resumed since its (seq, id) was queued is skipped when pruning.
+    uint64_t next_retired_ = 0;
+    std::deque<std::pair<uint64_t, int>> retired_order_;
+    std::unordered_map<int, uint64_t> retired_;
+
+    // Declared last: its threads call back into the members above
+    MetadataProber prober_;
+
+    // tools/bench drives on_download_event without starting any download
+    friend struct EngineBench;
+
+    DownloadEntry* find(int id);
+    void touch(DownloadEntry* entry);
+    void notify();
+    void start_download(DownloadEntry* entry);
+    void on_download_event(int download_id, const DownloadEvent& event);
+    void on_probed(const std::string& url, const PreDownloadInfo& info);
+    bool learn(const std::string& url, const PreDownloadInfo& info);
+    void unindex_pending(const DownloadEntry* entry);
+    void settle(DownloadEntry* entry, DownloadStatus status);
+    void retire(int id);
+    void prune_finished();
+    bool stop(int id, DownloadStatus status);
+    void try_start_queued();
+    void reap_threads();
+};
+
+#endif // CDOWNLOAD_MANAGER_ENGINE_H
@@ -0,0 +1,80 @@
+#ifndef CDOWNLOAD_MANAGER_EXTRACTOR_H
+#define CDOWNLOAD_MANAGER_EXTRACTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class Compression { NONE, GZIP, ZSTD, XZ };
+
+// What a download's filename says it contains
+struct ArchiveFormat {
+    Compression compression = Compression::NONE;
+    bool tar = false;
+    std::string stem; // output name for a compressed non-tar file
+
+    bool extractable() const { return tar || compression != Compression::NONE; }
+    static ArchiveFormat detect(const std::string &filename);
+    // False when the codec wasn't compiled in
+    bool supported() const;
+};
+
+// Decompresses and unpacks a download on its own thread while it is still
+// being transferred. Bytes arrive either pushed in file order (feed(), for a
+// single stream, which then never needs to touch disk) or by following the
+// contiguous prefix of a file written out of order (follow()/advance(), for
+// parallel segments), which is read back while still in the page cache.
+class StreamExtractor {
+public:
+    StreamExtractor(ArchiveFormat format, std::string dest_dir);
+    ~StreamExtractor();
+
+    StreamExtractor(const StreamExtractor &) = delete;
+    StreamExtractor &operator=(const StreamExtractor &) = delete;
+
+    void start();
+
+    // Push mode; blocks while the queue is full so a slow disk throttles
+    // the transfer instead of buffering without bound
+    bool feed(const char *data, size_t size);
+
+    // Follow mode: bytes [0, frontier) of `path` are final
+    void follow(const std::string &path);
+    void advance(size_t frontier);
+
+    // End of input; waits for the worker and returns whether everything
+    // was extracted
+    bool finish();
+    void abort();
+
+    const std::string &error() const { return error_; }
+
+private:
+    ArchiveFormat format_;
+    std::string dest_dir_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<std::vector<char>> chunks_;
+    size_t queued_bytes_ = 0;
+    int follow_fd_ = -1;
+    size_t frontier_ = 0;
+    size_t consumed_ = 0; // follow mode, worker only
+    bool eof_ = false;
+    std::atomic<bool> aborted_{false};
+    std::atomic<bool> failed_{false};
+
+    std::string error_;
+    std::thread worker_;
+
+    void run();
+    bool next_input(std::vector<char> &buffer);
+};
+
+#endif // CDOWNLOAD_MANAGER_EXTRACTOR_H
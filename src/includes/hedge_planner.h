@@ -0,0 +1,60 @@
+#ifndef CDOWNLOAD_MANAGER_HEDGE_PLANNER_H
+#define CDOWNLOAD_MANAGER_HEDGE_PLANNER_H
+
+#include <cstddef>
+#include <vector>
+
+struct HedgePolicy {
+    // Bytes fetched twice by hedged races, as a fraction of the file; 0 = off
+    double budget = 0.05;
+    // Hedging starts once this fraction of the file has arrived
+    double start_fraction = 0.75;
+    // Hedges racing at the same time within one download
+    int max_hedges = 2;
+    // A segment is straggling when its recent rate is below this fraction of
+    // the median segment's average rate
+    double slow_ratio = 0.5;
+    // A shorter tail finishes before a new connection would pay off
+    size_t min_remaining = 256 * 1024;
+    // Send the hedge to another address of the host, when it resolves to more
+    // than one
+    bool other_address = true;
+};
+
+struct HedgeSample {
+    size_t remaining = 0; // bytes the segment still has to fetch
+    double rate = 0.0;    // recent bytes/s, see HedgePlanner::smooth
+    double average = 0.0; // bytes/s since the download started
+    bool active = false;  // still transferring
+    bool hedged = false;  // raced by a hedge right now
+};
+
+// Picks the segments whose tails get duplicated on a second connection once
+// most of the file is done. A race fetches twice what both sides got past
+// the hedge's start; new hedges are only launched while the expected
+// duplicate fits the budget, and racing ones are dropped once it is spent.
+class HedgePlanner {
+    HedgePolicy policy_;
+public:
+    explicit HedgePlanner(const HedgePolicy &policy) : policy_(policy) {}
+
+    const HedgePolicy &policy() const { return policy_; }
+    bool enabled() const { return policy_.budget > 0.0 && policy_.max_hedges > 0; }
+
+    // Indices of straggling segments to hedge now, latest expected finish
+    // first. `duplicated` is what earlier races already fetched twice.
+    std::vector<size_t> pick(const std::vector<HedgeSample> &samples, size_t total, size_t duplicated) const;
+    bool exhausted(size_t duplicated, size_t total) const;
+
+    // Bytes one race fetched twice: the segment at `offset`, its hedge from
+    // `hedge_begin` to `hedge_offset`
+    static size_t overlap(size_t offset, size_t hedge_begin, size_t hedge_offset) {
+        const size_t both = offset < hedge_offset ? offset : hedge_offset;
+        return both > hedge_begin ? both - hedge_begin : 0;
+    }
+
+    // Folds the rate seen over one monitor tick into a segment's recent rate
+    static double smooth(double rate, double tick_rate) { return rate * 0.8 + tick_rate * 0.2; }
+};
+
+#endif // CDOWNLOAD_MANAGER_HEDGE_PLANNER_H
@@ -0,0 +1,98 @@
+#ifndef CDOWNLOAD_MANAGER_METRICS_H
+#define CDOWNLOAD_MANAGER_METRICS_H
+
+#include "structs.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Aggregates the DownloadEvent stream into Prometheus-style series: live
+// per-download and per-segment gauges plus counters that survive the
+// download (finished downloads are dropped to bound cardinality).
+class MetricsCollector {
+public:
+    void record(const DownloadEntry &entry, const DownloadEvent &event);
+    void set_queue_depth(size_t queued);
+
+    // Prometheus text exposition format 0.0.4
+    std::string render() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Time-weighted EWMA so the smoothing doesn't depend on event rate
+    struct Rate {
+        double ewma = 0.0;
+        size_t last_bytes = 0;
+        Clock::time_point last;
+        bool primed = false;
+
+        void sample(size_t bytes, Clock::time_point now);
+    };
+
+    struct SegmentStats {
+        DownloadStatus status = PENDING;
+        size_t bytes = 0;
+        size_t total = 0;
+        int retries = 0;
+        int stalls = 0;
+        double ttfb = 0.0;
+        Rate rate;
+    };
+
+    struct DownloadStats {
+        std::string filename;
+        DownloadStatus status = PENDING;
+        size_t bytes = 0;
+        size_t size = 0;
+        double elapsed = 0.0;
+        Rate rate;
+        std::map<int, SegmentStats> segments;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<int, DownloadStats> downloads_;
+    size_t queue_depth_ = 0;
+
+    // Totals carried over from downloads that already ended
+    uint64_t retired_bytes_ = 0;
+    uint64_t retired_retries_ = 0;
+    uint64_t retired_stalls_ = 0;
+    uint64_t finished_ = 0;
+    uint64_t failed_ = 0;
+    uint64_t stopped_ = 0;
+};
+
+// Serves MetricsCollector::render() on 127.0.0.1:<port> and/or rewrites it
+// atomically to a file (for node_exporter's textfile collector).
+class MetricsExporter {
+public:
+    MetricsExporter(const MetricsCollector &collector, int port, std::string file, int interval_seconds)
+        : collector_(collector), port_(port), file_(std::move(file)), interval_seconds_(interval_seconds) {}
+    ~MetricsExporter() { stop(); }
+
+    MetricsExporter(const MetricsExporter &) = delete;
+    MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+    void start();
+    void stop();
+
+private:
+    const MetricsCollector &collector_;
+    int port_;
+    std::string file_;
+    int interval_seconds_;
+    int listen_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+
+    void loop();
+    void serve_one();
+    void write_file() const;
+};
+
+#endif // CDOWNLOAD_MANAGER_METRICS_H
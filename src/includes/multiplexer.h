@@ -0,0 +1,94 @@
+#ifndef CDOWNLOAD_MANAGER_MULTIPLEXER_H
+#define CDOWNLOAD_MANAGER_MULTIPLEXER_H
+
+#include <condition_variable>
+#include <curl/curl.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cpr {
+class Response;
+class Session;
+}
+
+// Runs transfers from many worker threads on one libcurl multi handle, so
+// range requests to the same HTTP/2 origin become streams on a shared
+// connection instead of one TCP/TLS handshake each. Callers block as they
+// would in Session::Get(); their callbacks run on the multiplexer's thread,
+// which every stream shares, so they must never block: they hand the bytes
+// to wake(), and the caller writes them from `drain`. A stream whose caller
+// falls behind pauses itself (CURL_WRITEFUNC_PAUSE) until resume().
+class Multiplexer {
+public:
+    // `connections_per_host` caps how many connections streams to one
+    // host:port may spread over
+    explicit Multiplexer(int connections_per_host = 1);
+    ~Multiplexer();
+
+    Multiplexer(const Multiplexer &) = delete;
+    Multiplexer &operator=(const Multiplexer &) = delete;
+
+    int connections_per_host() const { return connections_per_host_; }
+
+    // GET with everything already set on `session`; must not be given a
+    // session that uses the process-wide connection cache. `drain` runs on
+    // the calling thread after each wake() for the session's handle.
+    cpr::Response get(cpr::Session &session, const std::function<void()> &drain = {});
+
+    // From a transfer's callback: has the thread blocked in get() run drain
+    void wake(CURL *handle);
+    // From any thread: unpauses a transfer on the multiplexer's thread
+    void resume(CURL *handle);
+
+private:
+    struct Transfer {
+        CURLcode result = CURLE_OK;
+        bool done = false;
+        bool work = false; // wake() called since the last drain
+        std::condition_variable changed;
+    };
+
+    int connections_per_host_;
+    CURLM *multi_;
+    std::mutex mutex_;
+    std::vector<CURL *> incoming_; // not yet added to multi_
+    std::vector<CURL *> resuming_; // to unpause on the next loop
+    std::unordered_map<CURL *, Transfer *> transfers_;
+    bool stopping_ = false;
+    std::thread thread_; // started by the first transfer
+
+    CURLcode perform(CURL *handle, const std::function<void()> &drain);
+    void loop();
+};
+
+enum class Transport { CONNECTIONS, MULTIPLEX };
+
+// Learns per origin whether segments finish faster as multiplexed streams or
+// on separate connections. Each mode is tried once, then the faster one is
+// used, with the other re-measured every few downloads in case the network
+// or the server changed.
+class TransportSelector {
+public:
+    Transport choose(const std::string &origin);
+    // Throughput of a finished download that used `mode`
+    void record(const std::string &origin, Transport mode, double bytes_per_second);
+
+private:
+    struct Score {
+        double ewma = 0.0;
+        int samples = 0;
+    };
+    struct Origin {
+        Score modes[2];
+        int decisions = 0;
+    };
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, Origin> origins_;
+};
+
+#endif // CDOWNLOAD_MANAGER_MULTIPLEXER_H
@@ -0,0 +1,41 @@
+#ifndef CDOWNLOAD_MANAGER_NATIVE_HTTP_H
+#define CDOWNLOAD_MANAGER_NATIVE_HTTP_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// Minimal HTTP/1.1 range client for plain-http origins. Body bytes move from
+// the socket to the file with splice() through a pipe and never enter user
+// space; sockets are non-blocking, waited on with epoll, and kept alive per
+// origin between requests. Anything beyond a plain 206 (TLS, credentials,
+// redirects, chunked or compressed bodies, a 200) is left to libcurl.
+namespace native_http {
+
+enum class Result { DONE, RETRY, UNSUPPORTED, WRITE_ERROR };
+
+struct RangeRequest {
+    std::string url;
+    int fd = -1;
+    size_t from = 0;
+    size_t last = 0; // inclusive
+    // Polled at least every 250 ms while waiting; false aborts with RETRY
+    std::function<bool()> keep_going;
+    // Once the response headers checked out, before the first body byte
+    std::function<void()> on_response;
+    // After bytes [offset, offset + size) reached the file
+    std::function<void(size_t offset, size_t size)> on_written;
+    // Keep-alive sockets the origin may keep idle afterwards; 0 = no cap
+    size_t max_idle = 0;
+};
+
+// http:// on a platform with splice and epoll
+bool supported(const std::string &url);
+
+// UNSUPPORTED is only returned before anything was written. DONE means the
+// whole 206 reached the file, which may end short of `last`.
+Result fetch(const RangeRequest &request);
+
+}
+
+#endif // CDOWNLOAD_MANAGER_NATIVE_HTTP_H
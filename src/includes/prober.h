@@ -0,0 +1,71 @@
+#ifndef CDOWNLOAD_MANAGER_PROBER_H
+#define CDOWNLOAD_MANAGER_PROBER_H
+
+#include "structs.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Resolves size, range support, filename and redirects (HEAD) for queued
+// URLs on a few background threads, ahead of admission, so a freed slot can
+// start transferring without a round trip first. Results are cached per URL
+// for `ttl`; a redirect target only for REDIRECT_TTL, since signed CDN
+// locations expire quickly.
+class MetadataProber {
+public:
+    using Callback = std::function<void(const std::string &url, const PreDownloadInfo &info)>;
+
+    static constexpr std::chrono::seconds REDIRECT_TTL{60};
+
+    // `concurrency` 0 disables prefetching; get() then probes inline
+    MetadataProber(int concurrency, std::chrono::seconds ttl);
+    ~MetadataProber();
+
+    MetadataProber(const MetadataProber &) = delete;
+    MetadataProber &operator=(const MetadataProber &) = delete;
+
+    // Called from a prober thread after each background probe
+    void set_on_probed(Callback callback);
+
+    // Queues a background probe unless a fresh result or a probe exists
+    void request(const std::string &url);
+
+    // Fresh cached result, else waits for a running probe of the URL, else
+    // probes on the calling thread (jumping the background queue)
+    PreDownloadInfo get(const std::string &url);
+
+    // Stops the background threads; get() keeps working
+    void stop();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Cached {
+        PreDownloadInfo info;
+        Clock::time_point expires;
+    };
+    enum class State { QUEUED, RUNNING };
+
+    std::chrono::seconds ttl_;
+    Callback on_probed_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<std::string> queue_;
+    std::unordered_map<std::string, State> pending_;
+    std::unordered_map<std::string, Cached> cache_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+
+    const PreDownloadInfo *fresh(const std::string &url, Clock::time_point now) const;
+    void store(const std::string &url, const PreDownloadInfo &info);
+    void run();
+};
+
+#endif // CDOWNLOAD_MANAGER_PROBER_H
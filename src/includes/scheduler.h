@@ -0,0 +1,80 @@
+#ifndef CDOWNLOAD_MANAGER_SCHEDULER_H
+#define CDOWNLOAD_MANAGER_SCHEDULER_H
+
+#include "structs.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+enum class SchedulingPolicy { FIFO, SHORTEST_FIRST };
+
+// Admission queue for PENDING downloads. Entries are indexed per origin and
+// only each origin's best entry competes globally, so admitting or releasing
+// a download costs O(log n) regardless of how many entries are queued.
+class DownloadScheduler {
+public:
+    struct Limits {
+        int max_active = 3;
+        int max_per_host = 0; // 0 = no per-origin cap
+        SchedulingPolicy policy = SchedulingPolicy::FIFO;
+        // Idle connection slots; while positive, an origin with nothing
+        // running may start a download beyond max_active
+        std::function<int()> spare_connections;
+    };
+
+    DownloadScheduler() = default;
+    explicit DownloadScheduler(const Limits &limits) : limits_(limits) {}
+
+    void set_limits(const Limits &limits);
+
+    void enqueue(int id, const std::string &origin, DownloadPriority priority, size_t expected_size = 0);
+    void reprioritize(int id, DownloadPriority priority);
+    // Known sizes only reorder entries under SHORTEST_FIRST
+    void update_size(int id, size_t expected_size);
+    bool remove(int id);
+
+    // Pops every entry that may start now, best first, and marks it active.
+    std::vector<int> admit();
+    void release(int id);
+
+    size_t queued() const { return queued_.size(); }
+    int active() const { return static_cast<int>(active_.size()); }
+
+private:
+    // (priority, expected size, arrival): smaller is better
+    using Key = std::tuple<int, size_t, uint64_t>;
+    using Slot = std::pair<Key, int>;
+
+    struct Queued {
+        std::string origin;
+        DownloadPriority priority;
+        size_t expected_size;
+        uint64_t seq;
+        Key key;
+    };
+
+    struct Origin {
+        std::set<Slot> entries;
+        int active = 0;
+        std::optional<Slot> head; // entry currently published in ready_
+    };
+
+    Limits limits_;
+    uint64_t next_seq_ = 0;
+    std::unordered_map<int, Queued> queued_;
+    std::unordered_map<int, std::string> active_;
+    std::unordered_map<std::string, Origin> origins_;
+    std::set<Slot> ready_;
+
+    Key make_key(DownloadPriority priority, size_t expected_size, uint64_t seq) const;
+    void requeue(int id, Queued &q);
+    void refresh(const std::string &origin);
+};
+
+#endif // CDOWNLOAD_MANAGER_SCHEDULER_H
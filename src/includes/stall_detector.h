@@ -0,0 +1,34 @@
+#ifndef CDOWNLOAD_MANAGER_STALL_DETECTOR_H
+#define CDOWNLOAD_MANAGER_STALL_DETECTOR_H
+
+#include <cstddef>
+#include <vector>
+
+struct StallPolicy {
+    double window_seconds = 5.0;
+    // Absolute floor: a segment moving less than this per window is stalled
+    size_t min_bytes_per_window = 5 * 16 * 1024;
+    // Relative floor: stalled when below this fraction of the median peer
+    double peer_ratio = 0.1;
+    // Windows a fresh connection gets (connect, TLS, TTFB) before being judged
+    int grace_windows = 1;
+};
+
+struct SegmentSample {
+    size_t window_bytes = 0; // bytes received during the last window
+    int windows = 0;         // full windows observed on the current connection
+    bool active = false;     // still transferring
+};
+
+class StallDetector {
+    StallPolicy policy_;
+public:
+    explicit StallDetector(const StallPolicy &policy) : policy_(policy) {}
+
+    const StallPolicy &policy() const { return policy_; }
+
+    // Returns the indices of the samples that should be aborted and re-issued.
+    std::vector<size_t> stalled(const std::vector<SegmentSample> &samples) const;
+};
+
+#endif // CDOWNLOAD_MANAGER_STALL_DETECTOR_H
@@ -4,16 +4,21 @@
 #ifndef CDOWNLOAD_MANAGER_STRUCTS_H
 #define CDOWNLOAD_MANAGER_STRUCTS_H
 
+#include <cstdint>
 #include <map>
 #include <ostream>
 #include <string>
 
-enum DownloadStatus { PENDING, STARTED, RUNNING, FINISHED, FAILED };
+enum DownloadStatus { PENDING, STARTED, RUNNING, FINISHED, FAILED, PAUSED, CANCELLED };
+
+enum DownloadPriority { PRIORITY_HIGH, PRIORITY_NORMAL, PRIORITY_LOW };
 
 struct DownloadOptions {
     const std::string &url;
     const std::string &out;
     const size_t &c_size;
+    int id = -1; // DownloadEntry id, labels the download's trace spans
+    std::string if_range = {}; // PreDownloadInfo::validator
 };
 
 struct PreDownloadInfo {
@@ -21,6 +26,10 @@ struct PreDownloadInfo {
     size_t content_size;
     std::string url;
     std::string filename;
+    bool multiplexed = false; // answered over HTTP/2 or later
+    // Strong ETag, else Last-Modified: an If-Range value that tells apart
+    // another copy of the file; empty when the server sent neither
+    std::string validator = {};
 
     static PreDownloadInfo check_info(const std::string &url, const bool &header_only = false);
 };
@@ -32,6 +41,8 @@ inline std::ostream& operator<<(std::ostream& os, const DownloadStatus status) {
         case RUNNING:  return os << "RUNNING";
         case FINISHED: return os << "FINISHED";
         case FAILED:   return os << "FAILED";
+        case PAUSED:   return os << "PAUSED";
+        case CANCELLED: return os << "CANCELLED";
         default:       return os << "UNKNOWN";
     }
 }
@@ -42,6 +53,7 @@ inline std::ostream& operator<<(std::ostream& os, const PreDownloadInfo& info) {
        << ", content_size=" << info.content_size
        << ", url=" << info.url
        << ", filename=" << info.filename
+       << ", multiplexed=" << info.multiplexed
        << "}";
     return os;
 }
@@ -52,6 +64,9 @@ struct DownloadEvent {
     size_t total_bytes;
     double elapsed_seconds;
     int thread_id = -1;
+    int retries = 0;
+    int stalls = 0;
+    double ttfb_seconds = 0.0; // latest connection's time to first body byte
 };
 
 struct ThreadState {
@@ -59,6 +74,7 @@ struct ThreadState {
     size_t bytes_downloaded = 0;
     size_t total_bytes = 0;
     double elapsed_seconds = 0.0;
+    int retries = 0;
 };
 
 struct DownloadEntry {
@@ -67,11 +83,14 @@ struct DownloadEntry {
     std::string filename;
     std::string output_dir;
     std::string output_path;
+    std::string origin;
+    DownloadPriority priority = PRIORITY_NORMAL;
     bool accept_ranges = false;
     size_t content_size = 0;
     DownloadStatus status = PENDING;
     size_t bytes_downloaded = 0;
     double elapsed_seconds = 0.0;
+    uint64_t version = 0; // bumped by the engine on every change
     std::map<int, ThreadState> threads;
 };
 
@@ -0,0 +1,67 @@
+#ifndef CDOWNLOAD_MANAGER_TRACE_H
+#define CDOWNLOAD_MANAGER_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Opt-in span tracing dumped as Chrome trace JSON (chrome://tracing, Perfetto).
+// Each thread records into its own fixed-size ring buffer without locking;
+// while tracing is off every call is a single relaxed load.
+namespace trace {
+
+    inline std::atomic<bool> active{false};
+
+    inline bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    // Nanoseconds on the steady clock
+    uint64_t now();
+
+    // Tags the calling thread's spans: one process per download, one track
+    // per segment (-1 for the download's own thread).
+    void set_track(int download, int segment = -1);
+    // Labels a download in the trace viewer
+    void name_download(int download, const std::string &name);
+
+    // Names must be string literals: only the pointer is stored.
+    void complete(const char *name, const char *category, uint64_t begin, uint64_t end,
+                  int64_t value = -1, const char *value_name = nullptr);
+    void instant(const char *name, const char *category, int64_t value = -1,
+                 const char *value_name = nullptr);
+
+    // Records [construction, destruction) as a complete event
+    class Span {
+        const char *name_;
+        const char *category_;
+        uint64_t begin_;
+    public:
+        int64_t value = -1;
+        const char *value_name = nullptr;
+
+        Span(const char *name, const char *category)
+            : name_(name), category_(category), begin_(enabled() ? now() : 0) {}
+        ~Span() {
+            if (begin_ != 0 && enabled()) complete(name_, category_, begin_, now(), value, value_name);
+        }
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+    };
+
+    // Enables tracing for its lifetime and writes the trace to `path` on exit
+    class Recording {
+        std::string path_;
+    public:
+        explicit Recording(std::string path);
+        ~Recording();
+
+        Recording(const Recording &) = delete;
+        Recording &operator=(const Recording &) = delete;
+    };
+
+    // Writes every buffered event; returns false when the file can't be written
+    bool dump(const std::string &path);
+
+}
+
+#endif // CDOWNLOAD_MANAGER_TRACE_H
@@ -2,45 +2,39 @@
 #define CDOWNLOAD_MANAGER_UI_H
 
 #include "config.h"
-#include "observer.h"
+#include "engine.h"
 #include "structs.h"
-#include <functional>
-#include <memory>
-#include <mutex>
+#include <cstdint>
 #include <string>
-#include <thread>
-#include <vector>
+#include <unordered_map>
 
 namespace ftxui {
 class ScreenInteractive;
 }
 
-class DownloadObserverAdapter : public IObserver<DownloadEvent> {
-    int download_id_;
-    std::function<void(int, const DownloadEvent&)> callback_;
-public:
-    DownloadObserverAdapter(int id, std::function<void(int, const DownloadEvent&)> cb)
-        : download_id_(id), callback_(std::move(cb)) {}
-
-    void on_update(const DownloadEvent& event) override {
-        callback_(download_id_, event);
-    }
-};
-
 class AppUI {
 public:
-    explicit AppUI(AppConfig config);
+    AppUI(AppConfig config, DownloadService& service);
     void run(const std::string& initial_url = "", const std::string& output_dir = ".");
 
 private:
     AppConfig config_;
-    std::mutex mutex_;
+    DownloadService& service_;
     ftxui::ScreenInteractive* screen_ = nullptr;
 
-    int next_id_ = 0;
-    std::vector<std::unique_ptr<DownloadEntry>> downloads_;
-    std::vector<std::thread> download_threads_;
+    // UI-thread state; entries themselves are read through service_
     int selected_ = 0;
+    int first_row_ = 0; // first entry of the rendered window
+
+    // Display strings for one list row, rebuilt only when the entry's
+    // version moves
+    struct Row {
+        uint64_t version = UINT64_MAX;
+        std::string label;
+        std::string percent;
+        float progress = 0.0f;
+    };
+    std::unordered_map<int, Row> rows_;
 
     std::string url_input_;
     std::string cfg_connections_;
@@ -52,9 +46,11 @@ private:
     bool editing_config_ = false;
 
     void submit_url();
-    void start_download(DownloadEntry* entry);
-    void on_download_event(int download_id, const DownloadEvent& event);
-    void try_start_queued();
+    void change_priority(int delta);
+    void toggle_pause();
+    void cancel_selected();
+    const DownloadEntry* selected_entry(const DownloadService::Entries& entries) const;
+    const Row& refresh_row(const DownloadEntry& entry);
     void save_config();
 };
 
@@ -1,15 +1,26 @@
 #ifndef CDOWNLOAD_MANAGER_UTILS_H
 #define CDOWNLOAD_MANAGER_UTILS_H
 
+#include "constants.h"
 #include <cstddef>
 #include <string>  // IWYU pragma: keep
+#include <string_view>
 #include <vector>  // IWYU pragma: keep
 #include <cpr/range.h>
 
 namespace download_manager::utils {
   std::vector<cpr::Range> split_ranges(size_t total, size_t parts);
+  bool should_split(size_t size, bool accept_ranges, size_t min_split_size = constants::MIN_SPLIT_SIZE);
   std::string extract_filename_from_url(const std::string& url);
   std::string extract_filename_from_header(const std::string& header_value);
+  std::string extract_origin_from_url(const std::string& url);
+  std::string format_bytes(size_t bytes);
+  std::string format_time(double seconds);
+  // Status code of an "HTTP/x y" status line, 0 for any other line
+  long parse_status_line(std::string_view line);
+  // "Content-Range: bytes <first>-<last>/<total>" (header name is
+  // case-insensitive)
+  bool parse_content_range(std::string_view line, size_t& first, size_t& last);
 }
 
 #endif // CDOWNLOAD_MANAGER_UTILS_H
@@ -0,0 +1,96 @@
+#ifndef CDOWNLOAD_MANAGER_WRITE_BACK_H
+#define CDOWNLOAD_MANAGER_WRITE_BACK_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+enum class SyncPolicy {
+    NONE,   // leave flushing to the kernel; still renamed on completion
+    FINISH, // fsync before the rename
+    BATCH,  // FINISH, plus writeback started every batch while transferring
+};
+
+SyncPolicy parse_sync_policy(const std::string &name);
+
+// How a large download treats the page cache
+enum class CacheMode {
+    NORMAL,   // buffered writes; pages linger until the kernel evicts them
+    DONTNEED, // buffered, but pages already written back are dropped
+    DIRECT,   // O_DIRECT through DirectWriter, bypassing the cache
+};
+
+CacheMode parse_cache_mode(const std::string &name);
+
+// Downloads are written to "<out>.part" and only appear under their final
+// name once complete, so anything watching the directory never sees a
+// truncated file.
+std::string part_path(const std::string &out);
+
+// Flushing policy for one open download file. Under BATCH, every `batch`
+// bytes written starts writeback of the file and first waits for the
+// previous batch, so dirty pages never pile up into one long stall at the
+// final fsync. With `drop_cache`, the same batches run whatever the policy
+// and the pages they waited for, now clean, are dropped from the cache.
+class WriteBack {
+public:
+    WriteBack(int fd, SyncPolicy policy, size_t batch, bool drop_cache = false);
+
+    // After each write; safe from any thread. The writer that completes a
+    // batch waits for the previous one to reach the disk, which throttles
+    // the transfer to the disk's pace.
+    void wrote(size_t bytes);
+
+    // Makes the written data durable; false if the disk reported an error
+    bool finish();
+
+private:
+    int fd_;
+    SyncPolicy policy_;
+    size_t batch_;
+    bool drop_cache_;
+    std::atomic<size_t> pending_{0};
+    std::mutex flushing_;
+};
+
+// O_DIRECT writes for one sequential stream (a segment or a single
+// download). Bytes are staged in an aligned buffer and written in whole
+// blocks; the unaligned head of a run and its final partial block go
+// through `buffered_fd`. Staged bytes only reach the file on a full buffer
+// or flush(), so nothing may read the file while a run is open.
+class DirectWriter {
+public:
+    static constexpr size_t BLOCK = 4096;
+    static constexpr size_t STAGING = 1024 * 1024;
+
+    DirectWriter(int direct_fd, int buffered_fd);
+    ~DirectWriter();
+
+    DirectWriter(const DirectWriter &) = delete;
+    DirectWriter &operator=(const DirectWriter &) = delete;
+
+    // Writes at `offset`; a write that doesn't continue the staged run
+    // flushes it first
+    bool write(const char *data, size_t size, size_t offset);
+    bool flush();
+
+private:
+    int direct_fd_;
+    int buffered_fd_;
+    char *buffer_;
+    size_t start_ = 0; // file offset of buffer_[0], block aligned
+    size_t staged_ = 0;
+};
+
+// -1 where the filesystem (tmpfs, some FUSE mounts) or the platform has no
+// O_DIRECT; callers then fall back to buffered writes
+int open_direct(const std::string &path);
+
+bool write_at(int fd, const char *data, size_t size, size_t offset);
+
+// Renames `part` to `out`, then syncs the directory so the rename itself
+// survives a crash (unless the policy is NONE)
+bool publish(const std::string &part, const std::string &out, SyncPolicy policy);
+
+#endif // CDOWNLOAD_MANAGER_WRITE_BACK_H
@@ -0,0 +1,292 @@
+#include "metrics.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <spdlog/spdlog.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr double RATE_TAU_SECONDS = 5.0;
+
+std::string escape_label(const std::string &value) {
+    std::string out;
+    out.reserve(value.size());
+    for (const char c : value) {
+        if (c == '\\') out += "\\\\";
+        else if (c == '"') out += "\\\"";
+        else if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    return out;
+}
+
+void header(std::ostringstream &os, const char *name, const char *type, const char *help) {
+    os << "# HELP " << name << ' ' << help << '\n'
+       << "# TYPE " << name << ' ' << type << '\n';
+}
+
+} // namespace
+
+void MetricsCollector::Rate::sample(size_t bytes, Clock::time_point now) {
+    if (!primed) {
+        primed = true;
+        last = now;
+        last_bytes = bytes;
+        return;
+    }
+
+    const double dt = std::chrono::duration<double>(now - last).count();
+    if (dt < 0.5) return;
+
+    const double instant = bytes > last_bytes ? static_cast<double>(bytes - last_bytes) / dt : 0.0;
+    const double alpha = 1.0 - std::exp(-dt / RATE_TAU_SECONDS);
+    ewma += alpha * (instant - ewma);
+    last = now;
+    last_bytes = bytes;
+}
+
+void MetricsCollector::record(const DownloadEntry &entry, const DownloadEvent &event) {
+    std::lock_guard lock(mutex_);
+    const auto now = Clock::now();
+
+    auto &d = downloads_[entry.id];
+    d.filename = entry.filename.empty() ? entry.url : entry.filename;
+    d.status = entry.status;
+    d.bytes = entry.bytes_downloaded;
+    d.size = entry.content_size;
+    d.elapsed = entry.elapsed_seconds;
+    d.rate.sample(d.bytes, now);
+
+    if (event.thread_id >= 0) {
+        auto &s = d.segments[event.thread_id];
+        s.status = event.status;
+        s.bytes = event.bytes_downloaded;
+        s.total = event.total_bytes;
+        s.retries = event.retries;
+        s.stalls = event.stalls;
+        s.ttfb = event.ttfb_seconds;
+        s.rate.sample(s.bytes, now);
+        return;
+    }
+
+    if (event.status == FINISHED || event.status == FAILED || event.status == PAUSED ||
+        event.status == CANCELLED) {
+        if (event.status == FINISHED) finished_++;
+        else if (event.status == FAILED) failed_++;
+        else stopped_++;
+        retired_bytes_ += d.bytes;
+        for (const auto &[_, s] : d.segments) {
+            retired_retries_ += static_cast<uint64_t>(s.retries);
+            retired_stalls_ += static_cast<uint64_t>(s.stalls);
+        }
+        downloads_.erase(entry.id);
+    }
+}
+
+void MetricsCollector::set_queue_depth(size_t queued) {
+    std::lock_guard lock(mutex_);
+    queue_depth_ = queued;
+}
+
+std::string MetricsCollector::render() const {
+    std::lock_guard lock(mutex_);
+    std::ostringstream os;
+
+    uint64_t bytes = retired_bytes_;
+    uint64_t retries = retired_retries_;
+    uint64_t stalls = retired_stalls_;
+    int connections = 0;
+    for (const auto &[_, d] : downloads_) {
+        bytes += d.bytes;
+        for (const auto &[__, s] : d.segments) {
+            retries += static_cast<uint64_t>(s.retries);
+            stalls += static_cast<uint64_t>(s.stalls);
+            if (s.status == RUNNING) connections++;
+        }
+    }
+
+    header(os, "cdm_bytes_downloaded_total", "counter", "Bytes written by all downloads.");
+    os << "cdm_bytes_downloaded_total " << bytes << '\n';
+    header(os, "cdm_downloads_finished_total", "counter", "Downloads that completed.");
+    os << "cdm_downloads_finished_total " << finished_ << '\n';
+    header(os, "cdm_downloads_failed_total", "counter", "Downloads that failed.");
+    os << "cdm_downloads_failed_total " << failed_ << '\n';
+    header(os, "cdm_downloads_stopped_total", "counter", "Downloads paused or cancelled while running.");
+    os << "cdm_downloads_stopped_total " << stopped_ << '\n';
+    header(os, "cdm_segment_retries_total", "counter", "Segment connections re-issued.");
+    os << "cdm_segment_retries_total " << retries << '\n';
+    header(os, "cdm_segment_stalls_total", "counter", "Segment connections aborted as stalled.");
+    os << "cdm_segment_stalls_total " << stalls << '\n';
+    header(os, "cdm_queue_depth", "gauge", "Downloads waiting for admission.");
+    os << "cdm_queue_depth " << queue_depth_ << '\n';
+    header(os, "cdm_downloads_active", "gauge", "Downloads admitted and not yet finished.");
+    os << "cdm_downloads_active " << downloads_.size() << '\n';
+    header(os, "cdm_active_connections", "gauge", "Segment connections currently transferring.");
+    os << "cdm_active_connections " << connections << '\n';
+
+    header(os, "cdm_download_info", "gauge", "Static labels of an active download.");
+    for (const auto &[id, d] : downloads_) {
+        std::ostringstream status;
+        status << d.status;
+        os << "cdm_download_info{id=\"" << id << "\",file=\"" << escape_label(d.filename)
+           << "\",status=\"" << status.str() << "\"} 1\n";
+    }
+
+    header(os, "cdm_download_bytes", "gauge", "Bytes downloaded so far.");
+    for (const auto &[id, d] : downloads_) {
+        os << "cdm_download_bytes{id=\"" << id << "\"} " << d.bytes << '\n';
+    }
+    header(os, "cdm_download_size_bytes", "gauge", "Expected size, 0 when unknown.");
+    for (const auto &[id, d] : downloads_) {
+        os << "cdm_download_size_bytes{id=\"" << id << "\"} " << d.size << '\n';
+    }
+    header(os, "cdm_download_rate_bytes_per_second", "gauge", "EWMA-smoothed transfer rate.");
+    for (const auto &[id, d] : downloads_) {
+        os << "cdm_download_rate_bytes_per_second{id=\"" << id << "\"} " << d.rate.ewma << '\n';
+    }
+    header(os, "cdm_download_eta_seconds", "gauge", "Remaining bytes over the smoothed rate.");
+    for (const auto &[id, d] : downloads_) {
+        if (d.size == 0 || d.rate.ewma <= 0.0 || d.bytes >= d.size) continue;
+        os << "cdm_download_eta_seconds{id=\"" << id << "\"} "
+           << static_cast<double>(d.size - d.bytes) / d.rate.ewma << '\n';
+    }
+    header(os, "cdm_download_elapsed_seconds", "gauge", "Time since the download started.");
+    for (const auto &[id, d] : downloads_) {
+        os << "cdm_download_elapsed_seconds{id=\"" << id << "\"} " << d.elapsed << '\n';
+    }
+
+    header(os, "cdm_segment_bytes", "gauge", "Bytes downloaded by a segment.");
+    for (const auto &[id, d] : downloads_) {
+        for (const auto &[tid, s] : d.segments) {
+            os << "cdm_segment_bytes{id=\"" << id << "\",segment=\"" << tid << "\"} " << s.bytes << '\n';
+        }
+    }
+    header(os, "cdm_segment_rate_bytes_per_second", "gauge", "EWMA-smoothed segment rate.");
+    for (const auto &[id, d] : downloads_) {
+        for (const auto &[tid, s] : d.segments) {
+            os << "cdm_segment_rate_bytes_per_second{id=\"" << id << "\",segment=\"" << tid << "\"} "
+               << s.rate.ewma << '\n';
+        }
+    }
+    header(os, "cdm_segment_ttfb_seconds", "gauge", "Time to first byte of the segment's latest connection.");
+    for (const auto &[id, d] : downloads_) {
+        for (const auto &[tid, s] : d.segments) {
+            if (s.ttfb <= 0.0) continue;
+            os << "cdm_segment_ttfb_seconds{id=\"" << id << "\",segment=\"" << tid << "\"} " << s.ttfb << '\n';
+        }
+    }
+
+    return os.str();
+}
+
+void MetricsExporter::start() {
+    if (running_ || (port_ <= 0 && file_.empty())) return;
+
+    if (port_ > 0) {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port_));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (listen_fd_ < 0 ||
+            bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+            listen(listen_fd_, 16) < 0) {
+            spdlog::error("metrics: falha ao escutar em 127.0.0.1:{}", port_);
+            if (listen_fd_ >= 0) close(listen_fd_);
+            listen_fd_ = -1;
+        } else {
+            spdlog::info("metrics: servindo em http://127.0.0.1:{}/metrics", port_);
+        }
+    }
+
+    running_ = true;
+    thread_ = std::thread([this] { loop(); });
+}
+
+void MetricsExporter::stop() {
+    if (!running_.exchange(false)) return;
+    if (thread_.joinable()) thread_.join();
+    if (listen_fd_ >= 0) close(listen_fd_);
+    listen_fd_ = -1;
+    // Leave a final snapshot behind
+    if (!file_.empty()) write_file();
+}
+
+void MetricsExporter::loop() {
+    auto next_write = std::chrono::steady_clock::now();
+
+    while (running_) {
+        if (!file_.empty() && std::chrono::steady_clock::now() >= next_write) {
+            write_file();
+            next_write = std::chrono::steady_clock::now() + std::chrono::seconds(std::max(1, interval_seconds_));
+        }
+
+        if (listen_fd_ < 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            continue;
+        }
+
+        pollfd pfd{listen_fd_, POLLIN, 0};
+        if (poll(&pfd, 1, 250) > 0 && (pfd.revents & POLLIN)) {
+            serve_one();
+        }
+    }
+}
+
+void MetricsExporter::serve_one() {
+    const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) return;
+
+    // The request itself is irrelevant: every path returns the exposition.
+    // Wait briefly for it so the client doesn't see a reset.
+    char buf[1024];
+    pollfd pfd{fd, POLLIN, 0};
+    if (poll(&pfd, 1, 1000) > 0) {
+        [[maybe_unused]] const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    }
+
+    const std::string body = collector_.render();
+    const std::string head = "HTTP/1.1 200 OK\r\n"
+                             "Content-Type: text/plain; version=0.0.4\r\n"
+                             "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                             "Connection: close\r\n\r\n";
+    const std::string response = head + body;
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        const ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += static_cast<size_t>(n);
+    }
+    close(fd);
+}
+
+void MetricsExporter::write_file() const {
+    const std::string tmp = file_ + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out.is_open()) {
+            spdlog::warn("metrics: falha ao escrever {}", tmp);
+            return;
+        }
+        out << collector_.render();
+    }
+
+    std::error_code ec;
+    fs::rename(tmp, file_, ec);
+    if (ec) spdlog::warn("metrics: falha ao renomear {}: {}", tmp, ec.message());
+}
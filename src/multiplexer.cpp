@@ -0,0 +1,155 @@
+#include "multiplexer.h"
+#include <cpr/response.h>
+#include <cpr/session.h>
+
+namespace {
+
+// Every EXPLORE_EVERY-th download to an origin re-measures the mode that
+// is currently losing
+constexpr int EXPLORE_EVERY = 8;
+constexpr double EWMA_WEIGHT = 0.3;
+
+}
+
+Multiplexer::Multiplexer(int connections_per_host)
+    : connections_per_host_(connections_per_host), multi_(curl_multi_init()) {
+    curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    if (connections_per_host > 0) {
+        curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(connections_per_host));
+    }
+}
+
+Multiplexer::~Multiplexer() {
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    curl_multi_wakeup(multi_);
+    if (thread_.joinable()) thread_.join();
+    curl_multi_cleanup(multi_);
+}
+
+cpr::Response Multiplexer::get(cpr::Session &session, const std::function<void()> &drain) {
+    session.PrepareGet();
+    return session.Complete(perform(session.GetCurlHolder()->handle, drain));
+}
+
+void Multiplexer::wake(CURL *handle) {
+    std::lock_guard lock(mutex_);
+    if (auto it = transfers_.find(handle); it != transfers_.end()) {
+        it->second->work = true;
+        it->second->changed.notify_one();
+    }
+}
+
+void Multiplexer::resume(CURL *handle) {
+    {
+        std::lock_guard lock(mutex_);
+        resuming_.push_back(handle);
+    }
+    curl_multi_wakeup(multi_);
+}
+
+CURLcode Multiplexer::perform(CURL *handle, const std::function<void()> &drain) {
+    // Ask for h2 and wait for a connection that is still being set up to
+    // offer a stream, rather than racing it with a handshake of our own
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+
+    Transfer transfer;
+    {
+        std::lock_guard lock(mutex_);
+        if (!thread_.joinable()) thread_ = std::thread(&Multiplexer::loop, this);
+        transfers_[handle] = &transfer;
+        incoming_.push_back(handle);
+    }
+    curl_multi_wakeup(multi_);
+
+    std::unique_lock lock(mutex_);
+    while (true) {
+        transfer.changed.wait(lock, [&] { return transfer.done || transfer.work; });
+        if (!transfer.work) break;
+        transfer.work = false;
+        lock.unlock();
+        if (drain) drain();
+        lock.lock();
+    }
+    return transfer.result;
+}
+
+void Multiplexer::loop() {
+    int running = 0;
+    std::vector<CURL *> resuming;
+    while (true) {
+        {
+            std::lock_guard lock(mutex_);
+            if (stopping_ && transfers_.empty()) break;
+            for (CURL *handle : incoming_) {
+                curl_multi_add_handle(multi_, handle);
+            }
+            incoming_.clear();
+            // Only this thread ends transfers, so one still listed here is
+            // still in multi_ when unpaused below
+            for (CURL *handle : resuming_) {
+                if (transfers_.count(handle)) resuming.push_back(handle);
+            }
+            resuming_.clear();
+        }
+        // Outside the lock: unpausing delivers held data to the write
+        // callback, which calls wake()
+        for (CURL *handle : resuming) {
+            curl_easy_pause(handle, CURLPAUSE_CONT);
+        }
+        resuming.clear();
+
+        curl_multi_perform(multi_, &running);
+
+        int left = 0;
+        while (CURLMsg *msg = curl_multi_info_read(multi_, &left)) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            CURL *handle = msg->easy_handle;
+            const CURLcode result = msg->data.result;
+            curl_multi_remove_handle(multi_, handle);
+
+            // Notified under the lock: the Transfer lives on the waiting
+            // caller's stack and goes away as soon as it sees `done`
+            std::lock_guard lock(mutex_);
+            if (auto it = transfers_.find(handle); it != transfers_.end()) {
+                it->second->result = result;
+                it->second->done = true;
+                it->second->changed.notify_one();
+                transfers_.erase(it);
+            }
+        }
+
+        // Returns early on socket activity or curl_multi_wakeup()
+        curl_multi_poll(multi_, nullptr, 0, 1000, nullptr);
+    }
+}
+
+Transport TransportSelector::choose(const std::string &origin) {
+    std::lock_guard lock(mutex_);
+    Origin &o = origins_[origin];
+    const int decision = ++o.decisions;
+    const Score &multiplex = o.modes[static_cast<int>(Transport::MULTIPLEX)];
+    const Score &connections = o.modes[static_cast<int>(Transport::CONNECTIONS)];
+
+    // Streams are the cheaper guess, so they get measured first
+    if (multiplex.samples == 0) return Transport::MULTIPLEX;
+    if (connections.samples == 0) return Transport::CONNECTIONS;
+
+    const bool streams_win = multiplex.ewma >= connections.ewma;
+    if (decision % EXPLORE_EVERY == 0) {
+        return streams_win ? Transport::CONNECTIONS : Transport::MULTIPLEX;
+    }
+    return streams_win ? Transport::MULTIPLEX : Transport::CONNECTIONS;
+}
+
+void TransportSelector::record(const std::string &origin, Transport mode, double bytes_per_second) {
+    if (bytes_per_second <= 0.0) return;
+    std::lock_guard lock(mutex_);
+    Score &score = origins_[origin].modes[static_cast<int>(mode)];
+    score.ewma = score.samples == 0 ? bytes_per_second
+                                    : score.ewma * (1.0 - EWMA_WEIGHT) + bytes_per_second * EWMA_WEIGHT;
+    score.samples++;
+}
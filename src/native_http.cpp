@@ -0,0 +1,437 @@
+#include "native_http.h"
+
+#ifdef __linux__
+
+#include "utils.h"
+#include "write_back.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <spdlog/spdlog.h>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace native_http {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int POLL_MS = 250;
+constexpr int CONNECT_TIMEOUT_MS = 10000;
+// Backstop only; the stall detector normally aborts a silent connection
+constexpr int IO_TIMEOUT_MS = 60000;
+constexpr size_t MAX_HEADER = 64 * 1024;
+constexpr size_t PIPE_SIZE = 1024 * 1024;
+constexpr auto IDLE_LIMIT = std::chrono::seconds(30);
+
+struct Target {
+    std::string host;
+    std::string port;
+    std::string authority; // Host header
+    std::string path;
+};
+
+bool starts_with_nocase(std::string_view s, std::string_view prefix) {
+    if (s.size() < prefix.size()) return false;
+    for (size_t i = 0; i < prefix.size(); ++i) {
+        if (std::tolower(static_cast<unsigned char>(s[i])) != prefix[i]) return false;
+    }
+    return true;
+}
+
+bool parse_target(const std::string &url, Target &t) {
+    constexpr std::string_view scheme = "http://";
+    if (!starts_with_nocase(url, scheme)) return false;
+
+    const std::string rest = url.substr(scheme.size());
+    const auto path_start = rest.find_first_of("/?#");
+    t.authority = rest.substr(0, path_start);
+    t.path = path_start == std::string::npos ? "/" : rest.substr(path_start);
+    t.path = t.path.substr(0, t.path.find('#'));
+    if (t.path.empty() || t.path.front() != '/') t.path.insert(0, "/");
+    if (t.authority.empty() || t.authority.find('@') != std::string::npos) return false;
+
+    if (t.authority.front() == '[') {
+        const auto close = t.authority.find(']');
+        if (close == std::string::npos) return false;
+        t.host = t.authority.substr(1, close - 1);
+        if (close + 1 < t.authority.size() && t.authority[close + 1] == ':') {
+            t.port = t.authority.substr(close + 2);
+        }
+    } else {
+        const auto colon = t.authority.rfind(':');
+        t.host = t.authority.substr(0, colon);
+        if (colon != std::string::npos) t.port = t.authority.substr(colon + 1);
+    }
+    if (t.port.empty()) t.port = "80";
+    return !t.host.empty();
+}
+
+// Value of "<name>: value" when the header line is `name` (lowercase)
+bool header_value(std::string_view line, std::string_view name, std::string_view &value) {
+    if (line.size() <= name.size() || line[name.size()] != ':' || !starts_with_nocase(line, name)) return false;
+    value = line.substr(name.size() + 1);
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+    return true;
+}
+
+class Poller {
+    int ep_;
+    int fd_;
+public:
+    explicit Poller(int fd) : ep_(epoll_create1(EPOLL_CLOEXEC)), fd_(fd) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev);
+    }
+    ~Poller() {
+        if (ep_ >= 0) close(ep_);
+    }
+    Poller(const Poller &) = delete;
+    Poller &operator=(const Poller &) = delete;
+
+    // False on timeout or once keep_going() turns false. Errors and hangups
+    // count as ready: the next socket call reports them.
+    bool wait(uint32_t events, int timeout_ms, const std::function<bool()> &keep_going) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd_;
+        epoll_ctl(ep_, EPOLL_CTL_MOD, fd_, &ev);
+        for (int waited = 0; waited < timeout_ms; waited += POLL_MS) {
+            if (keep_going && !keep_going()) return false;
+            epoll_event out{};
+            const int n = epoll_wait(ep_, &out, 1, std::min(POLL_MS, timeout_ms - waited));
+            if (n > 0) return true;
+            if (n < 0 && errno != EINTR) return false;
+        }
+        return false;
+    }
+};
+
+// Idle keep-alive sockets per host:port, oldest first. Every take() and
+// give() closes whatever went stale on any origin, so origins a daemon never
+// contacts again don't keep their sockets until exit.
+class Pool {
+    struct Idle {
+        int fd;
+        Clock::time_point since;
+    };
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::vector<Idle>> idle_;
+
+    void expire(Clock::time_point now) {
+        for (auto it = idle_.begin(); it != idle_.end();) {
+            std::erase_if(it->second, [now](const Idle &idle) {
+                if (now - idle.since < IDLE_LIMIT) return false;
+                close(idle.fd);
+                return true;
+            });
+            it = it->second.empty() ? idle_.erase(it) : std::next(it);
+        }
+    }
+
+    // A usable idle socket has nothing to read: no EOF, no stray bytes
+    static bool quiet(int fd) {
+        char c;
+        const ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+public:
+    ~Pool() {
+        for (auto &[_, sockets] : idle_) {
+            for (const Idle &idle : sockets) close(idle.fd);
+        }
+    }
+
+    int take(const std::string &origin) {
+        std::lock_guard lock(mutex_);
+        expire(Clock::now());
+        auto it = idle_.find(origin);
+        if (it == idle_.end()) return -1;
+        auto &sockets = it->second;
+        int fd = -1;
+        while (!sockets.empty() && fd < 0) {
+            const Idle idle = sockets.back();
+            sockets.pop_back();
+            if (quiet(idle.fd)) {
+                fd = idle.fd;
+            } else {
+                close(idle.fd);
+            }
+        }
+        if (sockets.empty()) idle_.erase(it);
+        return fd;
+    }
+
+    // Beyond `max_idle` sockets for the origin, the oldest is closed
+    void give(const std::string &origin, int fd, size_t max_idle) {
+        std::lock_guard lock(mutex_);
+        const auto now = Clock::now();
+        expire(now);
+        auto &sockets = idle_[origin];
+        if (max_idle > 0 && sockets.size() >= max_idle) {
+            const size_t excess = sockets.size() - max_idle + 1;
+            for (size_t i = 0; i < excess; ++i) close(sockets[i].fd);
+            sockets.erase(sockets.begin(), sockets.begin() + static_cast<std::ptrdiff_t>(excess));
+        }
+        sockets.push_back({fd, now});
+    }
+};
+
+Pool &pool() {
+    static Pool instance;
+    return instance;
+}
+
+int connect_to(const Target &t, const std::function<bool()> &keep_going) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = nullptr;
+    if (getaddrinfo(t.host.c_str(), t.port.c_str(), &hints, &addresses) != 0) return -1;
+
+    int fd = -1;
+    for (addrinfo *ai = addresses; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        if (errno == EINPROGRESS && Poller(fd).wait(EPOLLOUT, CONNECT_TIMEOUT_MS, keep_going)) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0) break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+
+    if (fd >= 0) {
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+struct Exchange {
+    Result result = Result::RETRY;
+    bool reusable = false;
+    bool silent = false; // the server never answered: a dead keep-alive socket
+};
+
+class Pipe {
+public:
+    int fds[2] = {-1, -1};
+    Pipe() {
+        if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0) {
+            fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(PIPE_SIZE));
+        }
+    }
+    ~Pipe() {
+        for (const int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+    }
+    Pipe(const Pipe &) = delete;
+    Pipe &operator=(const Pipe &) = delete;
+    bool ok() const { return fds[0] >= 0; }
+};
+
+Exchange exchange(int sock, const std::string &request, const RangeRequest &r) {
+    Exchange ex;
+    Poller poller(sock);
+
+    for (size_t sent = 0; sent < request.size();) {
+        const ssize_t n = send(sock, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += static_cast<size_t>(n);
+        } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            if (!poller.wait(EPOLLOUT, IO_TIMEOUT_MS, r.keep_going)) return ex;
+        } else {
+            ex.silent = true;
+            return ex;
+        }
+    }
+
+    // Headers; whatever body bytes arrive with them are written normally
+    std::string head;
+    size_t header_end = std::string::npos;
+    char buf[16384];
+    while (header_end == std::string::npos) {
+        const ssize_t n = recv(sock, buf, sizeof(buf), 0);
+        if (n > 0) {
+            head.append(buf, static_cast<size_t>(n));
+            header_end = head.find("\r\n\r\n");
+            if (header_end == std::string::npos && head.size() > MAX_HEADER) {
+                ex.result = Result::UNSUPPORTED;
+                return ex;
+            }
+        } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            if (!poller.wait(EPOLLIN, IO_TIMEOUT_MS, r.keep_going)) return ex;
+        } else {
+            ex.silent = head.empty();
+            return ex;
+        }
+    }
+
+    using namespace download_manager::utils;
+    const std::string_view headers(head.data(), header_end);
+    long status = 0;
+    bool has_range = false, has_length = false, keep_alive = true;
+    size_t first = 0, last = 0, length = 0;
+    bool plain = true;
+    size_t line_start = 0;
+    while (line_start <= headers.size()) {
+        auto line_end = headers.find("\r\n", line_start);
+        if (line_end == std::string_view::npos) line_end = headers.size();
+        const std::string_view line = headers.substr(line_start, line_end - line_start);
+        line_start = line_end + 2;
+
+        std::string_view value;
+        if (status == 0) {
+            status = parse_status_line(line);
+            if (line.rfind("HTTP/1.0", 0) == 0) keep_alive = false;
+        } else if (parse_content_range(line, first, last)) {
+            has_range = true;
+        } else if (header_value(line, "content-length", value)) {
+            has_length = !value.empty() && value.size() <= 19;
+            length = 0;
+            for (const char c : value) {
+                if (c < '0' || c > '9') has_length = false;
+                else length = length * 10 + static_cast<size_t>(c - '0');
+            }
+        } else if (header_value(line, "transfer-encoding", value) ||
+                   header_value(line, "content-encoding", value)) {
+            if (!starts_with_nocase(value, "identity")) plain = false;
+        } else if (header_value(line, "connection", value)) {
+            keep_alive = !starts_with_nocase(value, "close");
+        }
+    }
+
+    if (status != 206 || !plain || !has_range || first != r.from || last > r.last ||
+        (has_length && length != last - first + 1)) {
+        SPDLOG_DEBUG("native http: resposta nao suportada (status={}) para {}", status, r.url);
+        ex.result = Result::UNSUPPORTED;
+        return ex;
+    }
+    if (r.on_response) r.on_response();
+
+    size_t pos = first;
+    size_t remaining = last - first + 1;
+    const size_t early = std::min(remaining, head.size() - header_end - 4);
+    if (early > 0) {
+        if (!write_at(r.fd, head.data() + header_end + 4, early, pos)) {
+            ex.result = Result::WRITE_ERROR;
+            return ex;
+        }
+        r.on_written(pos, early);
+        pos += early;
+        remaining -= early;
+    }
+    // Bytes past the body mean the stream is out of step
+    keep_alive = keep_alive && head.size() - header_end - 4 == early;
+
+    Pipe pipe;
+    if (!pipe.ok()) return ex;
+    while (remaining > 0) {
+        if (r.keep_going && !r.keep_going()) return ex;
+
+        const ssize_t in = splice(sock, nullptr, pipe.fds[1], nullptr, std::min(remaining, PIPE_SIZE),
+                                  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in == 0) return ex; // closed mid-body
+        if (in < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) return ex;
+            if (!poller.wait(EPOLLIN, IO_TIMEOUT_MS, r.keep_going)) return ex;
+            continue;
+        }
+
+        for (size_t left = static_cast<size_t>(in); left > 0;) {
+            loff_t offset = static_cast<loff_t>(pos);
+            const ssize_t out = splice(pipe.fds[0], nullptr, r.fd, &offset, left, SPLICE_F_MOVE);
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) {
+                ex.result = Result::WRITE_ERROR;
+                return ex;
+            }
+            r.on_written(pos, static_cast<size_t>(out));
+            pos += static_cast<size_t>(out);
+            left -= static_cast<size_t>(out);
+            remaining -= static_cast<size_t>(out);
+        }
+    }
+
+    ex.result = Result::DONE;
+    ex.reusable = keep_alive;
+    return ex;
+}
+
+}
+
+bool supported(const std::string &url) {
+    Target t;
+    return parse_target(url, t);
+}
+
+Result fetch(const RangeRequest &request) {
+    Target t;
+    if (!parse_target(request.url, t)) return Result::UNSUPPORTED;
+
+    const std::string origin = t.host + ":" + t.port;
+    const std::string message = "GET " + t.path + " HTTP/1.1\r\n"
+                                "Host: " + t.authority + "\r\n"
+                                "Range: bytes=" + std::to_string(request.from) + "-" +
+                                std::to_string(request.last) + "\r\n"
+                                "Accept-Encoding: identity\r\n"
+                                "User-Agent: cdownload-manager\r\n"
+                                "Connection: keep-alive\r\n\r\n";
+
+    // A pooled socket the server already dropped gets one fresh retry
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int sock = pool().take(origin);
+        const bool reused = sock >= 0;
+        if (!reused) sock = connect_to(t, request.keep_going);
+        if (sock < 0) return Result::RETRY;
+
+        const Exchange ex = exchange(sock, message, request);
+        if (ex.reusable) {
+            pool().give(origin, sock, request.max_idle);
+        } else {
+            close(sock);
+        }
+        if (ex.result == Result::RETRY && ex.silent && reused) continue;
+        return ex.result;
+    }
+    return Result::RETRY;
+}
+
+}
+
+#else
+
+namespace native_http {
+
+bool supported(const std::string &) {
+    return false;
+}
+
+Result fetch(const RangeRequest &) {
+    return Result::UNSUPPORTED;
+}
+
+}
+
+#endif
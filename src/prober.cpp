@@ -0,0 +1,111 @@
+#include "prober.h"
+#include <algorithm>
+
+namespace {
+
+// Above this many cached URLs, expired ones are dropped on the next store
+constexpr size_t CACHE_PRUNE_SIZE = 1024;
+
+}
+
+MetadataProber::MetadataProber(int concurrency, std::chrono::seconds ttl) : ttl_(ttl) {
+    for (int i = 0; i < concurrency; ++i) {
+        workers_.emplace_back(&MetadataProber::run, this);
+    }
+}
+
+MetadataProber::~MetadataProber() {
+    stop();
+}
+
+void MetadataProber::set_on_probed(Callback callback) {
+    std::lock_guard lock(mutex_);
+    on_probed_ = std::move(callback);
+}
+
+void MetadataProber::request(const std::string &url) {
+    std::lock_guard lock(mutex_);
+    if (stopping_ || workers_.empty() || pending_.count(url) || fresh(url, Clock::now())) return;
+    pending_[url] = State::QUEUED;
+    queue_.push_back(url);
+    changed_.notify_all();
+}
+
+PreDownloadInfo MetadataProber::get(const std::string &url) {
+    {
+        std::unique_lock lock(mutex_);
+        changed_.wait(lock, [&] {
+            auto it = pending_.find(url);
+            return it == pending_.end() || it->second == State::QUEUED;
+        });
+        if (const PreDownloadInfo *info = fresh(url, Clock::now())) return *info;
+        // Still queued (or never asked for): probe here; the workers skip it
+        pending_[url] = State::RUNNING;
+    }
+
+    PreDownloadInfo info = PreDownloadInfo::check_info(url, false);
+    store(url, info);
+    return info;
+}
+
+void MetadataProber::stop() {
+    {
+        std::lock_guard lock(mutex_);
+        if (stopping_) return;
+        stopping_ = true;
+        queue_.clear();
+        std::erase_if(pending_, [](const auto &p) { return p.second == State::QUEUED; });
+    }
+    changed_.notify_all();
+    for (auto &worker : workers_) {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+const PreDownloadInfo *MetadataProber::fresh(const std::string &url, Clock::time_point now) const {
+    auto it = cache_.find(url);
+    if (it == cache_.end() || it->second.expires <= now) return nullptr;
+    return &it->second.info;
+}
+
+void MetadataProber::store(const std::string &url, const PreDownloadInfo &info) {
+    std::lock_guard lock(mutex_);
+    pending_.erase(url);
+    // check_info only leaves the filename empty when the request itself
+    // failed; that is worth retrying rather than caching
+    if (!info.filename.empty()) {
+        const auto now = Clock::now();
+        if (cache_.size() >= CACHE_PRUNE_SIZE) {
+            std::erase_if(cache_, [now](const auto &c) { return c.second.expires <= now; });
+        }
+        const auto ttl = info.url != url ? std::min(ttl_, std::chrono::seconds(REDIRECT_TTL)) : ttl_;
+        cache_[url] = {info, now + ttl};
+    }
+    changed_.notify_all();
+}
+
+void MetadataProber::run() {
+    while (true) {
+        std::string url;
+        {
+            std::unique_lock lock(mutex_);
+            changed_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+            if (stopping_) return;
+            url = std::move(queue_.front());
+            queue_.pop_front();
+            auto it = pending_.find(url);
+            if (it == pending_.end() || it->second != State::QUEUED) continue;
+            it->second = State::RUNNING;
+        }
+
+        const PreDownloadInfo info = PreDownloadInfo::check_info(url, false);
+        store(url, info);
+
+        Callback callback;
+        {
+            std::lock_guard lock(mutex_);
+            callback = on_probed_;
+        }
+        if (callback) callback(url, info);
+    }
+}
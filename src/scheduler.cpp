@@ -0,0 +1,144 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <limits>
+
+DownloadScheduler::Key DownloadScheduler::make_key(DownloadPriority priority, size_t expected_size,
+                                                   uint64_t seq) const {
+    size_t size_key = 0;
+    if (limits_.policy == SchedulingPolicy::SHORTEST_FIRST) {
+        // Unknown sizes queue behind known ones within the same class
+        size_key = expected_size > 0 ? expected_size : std::numeric_limits<size_t>::max();
+    }
+    return {static_cast<int>(priority), size_key, seq};
+}
+
+void DownloadScheduler::set_limits(const Limits &limits) {
+    const bool rekey = limits.policy != limits_.policy;
+    limits_ = limits;
+
+    if (rekey) {
+        for (auto &[id, q] : queued_) {
+            requeue(id, q);
+        }
+    }
+    for (const auto &[origin, _] : origins_) {
+        refresh(origin);
+    }
+}
+
+void DownloadScheduler::enqueue(int id, const std::string &origin, DownloadPriority priority,
+                                size_t expected_size) {
+    if (queued_.count(id) || active_.count(id)) return;
+
+    const uint64_t seq = next_seq_++;
+    Queued q{origin, priority, expected_size, seq, make_key(priority, expected_size, seq)};
+    origins_[origin].entries.insert({q.key, id});
+    queued_.emplace(id, std::move(q));
+    refresh(origin);
+}
+
+void DownloadScheduler::requeue(int id, Queued &q) {
+    auto &o = origins_[q.origin];
+    o.entries.erase({q.key, id});
+    q.key = make_key(q.priority, q.expected_size, q.seq);
+    o.entries.insert({q.key, id});
+}
+
+void DownloadScheduler::reprioritize(int id, DownloadPriority priority) {
+    auto it = queued_.find(id);
+    if (it == queued_.end() || it->second.priority == priority) return;
+
+    it->second.priority = priority;
+    requeue(id, it->second);
+    refresh(it->second.origin);
+}
+
+void DownloadScheduler::update_size(int id, size_t expected_size) {
+    auto it = queued_.find(id);
+    if (it == queued_.end() || it->second.expected_size == expected_size) return;
+
+    it->second.expected_size = expected_size;
+    if (limits_.policy != SchedulingPolicy::SHORTEST_FIRST) return;
+    requeue(id, it->second);
+    refresh(it->second.origin);
+}
+
+bool DownloadScheduler::remove(int id) {
+    auto it = queued_.find(id);
+    if (it == queued_.end()) return false;
+
+    const std::string origin = it->second.origin;
+    origins_[origin].entries.erase({it->second.key, id});
+    queued_.erase(it);
+    refresh(origin);
+    return true;
+}
+
+std::vector<int> DownloadScheduler::admit() {
+    std::vector<int> admitted;
+
+    int spare = -1;
+
+    while (!ready_.empty()) {
+        auto pick = ready_.end();
+        if (active() < limits_.max_active) {
+            pick = ready_.begin();
+        } else if (limits_.spare_connections) {
+            if (spare < 0) spare = limits_.spare_connections();
+            if (spare > 0) {
+                pick = std::find_if(ready_.begin(), ready_.end(), [&](const Slot &slot) {
+                    return origins_.at(queued_.at(slot.second).origin).active == 0;
+                });
+                if (pick != ready_.end()) spare--;
+            }
+        }
+        if (pick == ready_.end()) break;
+
+        const auto [key, id] = *pick;
+        auto it = queued_.find(id);
+        const std::string origin = it->second.origin;
+
+        auto &o = origins_[origin];
+        o.entries.erase({key, id});
+        o.active++;
+        queued_.erase(it);
+        active_.emplace(id, origin);
+        refresh(origin);
+
+        admitted.push_back(id);
+    }
+
+    return admitted;
+}
+
+void DownloadScheduler::release(int id) {
+    auto it = active_.find(id);
+    if (it == active_.end()) return;
+
+    const std::string origin = it->second;
+    active_.erase(it);
+    origins_[origin].active--;
+    refresh(origin);
+}
+
+void DownloadScheduler::refresh(const std::string &origin) {
+    auto it = origins_.find(origin);
+    if (it == origins_.end()) return;
+    auto &o = it->second;
+
+    std::optional<Slot> head;
+    const bool has_capacity = limits_.max_per_host <= 0 || o.active < limits_.max_per_host;
+    if (has_capacity && !o.entries.empty()) {
+        head = *o.entries.begin();
+    }
+
+    if (o.head != head) {
+        if (o.head) ready_.erase(*o.head);
+        if (head) ready_.insert(*head);
+        o.head = head;
+    }
+
+    if (o.entries.empty() && o.active == 0) {
+        origins_.erase(it);
+    }
+}
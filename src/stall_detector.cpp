@@ -0,0 +1,34 @@
+#include "stall_detector.h"
+#include <algorithm>
+
+std::vector<size_t> StallDetector::stalled(const std::vector<SegmentSample> &samples) const {
+	std::vector<size_t> result;
+
+	std::vector<size_t> established;
+	for (const auto &s : samples) {
+		if (s.active && s.windows >= policy_.grace_windows) {
+			established.push_back(s.window_bytes);
+		}
+	}
+	if (established.empty())
+		return result;
+
+	size_t median = 0;
+	if (established.size() >= 2) {
+		auto mid = established.begin() + static_cast<std::ptrdiff_t>(established.size() / 2);
+		std::nth_element(established.begin(), mid, established.end());
+		median = *mid;
+	}
+	const auto relative_floor = static_cast<size_t>(static_cast<double>(median) * policy_.peer_ratio);
+
+	for (size_t i = 0; i < samples.size(); ++i) {
+		const auto &s = samples[i];
+		if (!s.active || s.windows < policy_.grace_windows)
+			continue;
+		if (s.window_bytes < policy_.min_bytes_per_window || s.window_bytes < relative_floor) {
+			result.push_back(i);
+		}
+	}
+
+	return result;
+}
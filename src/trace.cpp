@@ -0,0 +1,275 @@
+#include "trace.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <spdlog/spdlog.h>
+#include <utility>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+constexpr size_t RING_CAPACITY = 16384; // events kept per thread
+
+struct Event {
+    const char *name;
+    const char *category;
+    const char *value_name;
+    uint64_t begin;
+    uint64_t end;
+    int64_t value;
+    int download;
+    int segment;
+    uint32_t thread;
+    char phase; // 'X' complete, 'i' instant
+};
+
+// Single producer (the owning thread), read by dump(). head counts every
+// event ever pushed; a slot is stable once head has moved past it and less
+// than RING_CAPACITY events have been pushed since.
+struct Ring {
+    std::array<Event, RING_CAPACITY> events{};
+    std::atomic<uint64_t> head{0};
+
+    // Owner-thread only
+    uint32_t thread = 0;
+    int download = -1;
+    int segment = -1;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::vector<Ring *> idle;
+    std::map<int, std::string> names;
+    uint32_t next_thread = 1;
+    uint64_t epoch = 0;
+};
+
+Registry &registry() {
+    static Registry instance;
+    return instance;
+}
+
+// Segment workers are short-lived, so a ring goes back to the pool when its
+// thread exits and the next thread keeps appending to it: memory is bounded
+// by the peak number of traced threads, not by how many ever ran.
+struct Owner {
+    Ring *ring = nullptr;
+
+    ~Owner() {
+        if (!ring) return;
+        auto &reg = registry();
+        std::lock_guard lock(reg.mutex);
+        reg.idle.push_back(ring);
+    }
+};
+
+thread_local Owner owner;
+
+Ring &local_ring() {
+    if (!owner.ring) {
+        auto &reg = registry();
+        std::lock_guard lock(reg.mutex);
+        if (!reg.idle.empty()) {
+            owner.ring = reg.idle.back();
+            reg.idle.pop_back();
+        } else {
+            reg.rings.push_back(std::make_unique<Ring>());
+            owner.ring = reg.rings.back().get();
+        }
+        owner.ring->thread = reg.next_thread++;
+        owner.ring->download = -1;
+        owner.ring->segment = -1;
+    }
+    return *owner.ring;
+}
+
+void push(char phase, const char *name, const char *category, uint64_t begin, uint64_t end,
+          int64_t value, const char *value_name) {
+    Ring &ring = local_ring();
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.events[head % RING_CAPACITY] = {name, category, value_name, begin, end, value,
+                                         ring.download, ring.segment, ring.thread, phase};
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void write_string(std::ostream &os, const std::string &value) {
+    os << '"';
+    for (const char c : value) {
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            os << buf;
+        } else {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+void write_micros(std::ostream &os, uint64_t nanos) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%llu.%03llu", static_cast<unsigned long long>(nanos / 1000),
+                  static_cast<unsigned long long>(nanos % 1000));
+    os << buf;
+}
+
+// One process per download (0 holds untagged threads); within a download,
+// track 0 is the download's own thread and track N+1 is segment N.
+std::pair<int, int> track_of(const Event &e) {
+    if (e.download < 0) return {0, static_cast<int>(e.thread)};
+    return {e.download + 1, e.segment + 1};
+}
+
+} // namespace
+
+uint64_t now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+void set_track(int download, int segment) {
+    if (!enabled()) return;
+    Ring &ring = local_ring();
+    ring.download = download;
+    ring.segment = segment;
+}
+
+void name_download(int download, const std::string &name) {
+    if (!enabled()) return;
+    auto &reg = registry();
+    std::lock_guard lock(reg.mutex);
+    reg.names[download] = name;
+}
+
+void complete(const char *name, const char *category, uint64_t begin, uint64_t end, int64_t value,
+              const char *value_name) {
+    if (!enabled()) return;
+    push('X', name, category, begin, end < begin ? begin : end, value, value_name);
+}
+
+void instant(const char *name, const char *category, int64_t value, const char *value_name) {
+    if (!enabled()) return;
+    const uint64_t t = now();
+    push('i', name, category, t, t, value, value_name);
+}
+
+Recording::Recording(std::string path) : path_(std::move(path)) {
+    {
+        auto &reg = registry();
+        std::lock_guard lock(reg.mutex);
+        reg.epoch = now();
+    }
+    active.store(true, std::memory_order_relaxed);
+    spdlog::info("tracing ativo: {}", path_);
+}
+
+Recording::~Recording() {
+    active.store(false, std::memory_order_relaxed);
+    if (dump(path_)) {
+        spdlog::info("trace gravado: {}", path_);
+    }
+}
+
+bool dump(const std::string &path) {
+    std::vector<Event> events;
+    std::map<int, std::string> names;
+    uint64_t epoch = 0;
+    {
+        auto &reg = registry();
+        std::lock_guard lock(reg.mutex);
+        epoch = reg.epoch;
+        names = reg.names;
+        for (const auto &ring : reg.rings) {
+            const uint64_t head = ring->head.load(std::memory_order_acquire);
+            const uint64_t first = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+            const size_t start = events.size();
+            for (uint64_t i = first; i < head; ++i) {
+                events.push_back(ring->events[i % RING_CAPACITY]);
+            }
+            // Drop slots the owner overwrote (or is overwriting) while we copied
+            const uint64_t after = ring->head.load(std::memory_order_acquire);
+            const uint64_t valid_from = after + 1 > RING_CAPACITY ? after + 1 - RING_CAPACITY : 0;
+            if (valid_from > first) {
+                const auto stale = static_cast<size_t>(std::min(valid_from, head) - first);
+                events.erase(events.begin() + static_cast<std::ptrdiff_t>(start),
+                             events.begin() + static_cast<std::ptrdiff_t>(start + stale));
+            }
+        }
+    }
+
+    std::ofstream out(path, std::ios::trunc);
+    if (!out.is_open()) {
+        spdlog::error("falha ao gravar trace: {}", path);
+        return false;
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&] {
+        if (!first) out << ",\n";
+        first = false;
+    };
+
+    std::set<std::pair<int, int>> tracks;
+    for (const auto &e : events) {
+        if (e.begin < epoch) continue;
+        const auto [pid, tid] = track_of(e);
+        tracks.emplace(pid, tid);
+
+        separator();
+        out << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"" << e.phase
+            << "\",\"pid\":" << pid << ",\"tid\":" << tid << ",\"ts\":";
+        write_micros(out, e.begin - epoch);
+        if (e.phase == 'X') {
+            out << ",\"dur\":";
+            write_micros(out, e.end - e.begin);
+        } else {
+            out << ",\"s\":\"t\"";
+        }
+        if (e.value_name) {
+            out << ",\"args\":{\"" << e.value_name << "\":" << e.value << '}';
+        }
+        out << '}';
+    }
+
+    std::set<int> processes;
+    for (const auto &[pid, tid] : tracks) {
+        if (processes.insert(pid).second) {
+            std::string name = "cdownload";
+            if (pid > 0) {
+                const auto it = names.find(pid - 1);
+                name = "download " + std::to_string(pid - 1) +
+                       (it != names.end() ? ": " + it->second : std::string());
+            }
+            separator();
+            out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":";
+            write_string(out, name);
+            out << "}}";
+        }
+        const std::string thread = pid == 0 ? "thread " + std::to_string(tid)
+                                 : tid == 0 ? std::string("download")
+                                            : "segment " + std::to_string(tid - 1);
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+            << ",\"args\":{\"name\":";
+        write_string(out, thread);
+        out << "}}";
+    }
+
+    out << "\n]}\n";
+    return out.good();
+}
+
+}
@@ -1,43 +1,28 @@
 #include "ui.h"
-#include "download_manager.h"
-#include "downloader.h"
 #include "structs.h"
+#include "utils.h"
 
 #include <ftxui/component/component.hpp>
 #include <ftxui/component/event.hpp>
 #include <ftxui/component/screen_interactive.hpp>
 #include <ftxui/dom/elements.hpp>
-#include <filesystem>
-#include <fstream>
-#include <iomanip>
+#include <algorithm>
 #include <memory>
-#include <sstream>
+#include <optional>
 #include <spdlog/spdlog.h>
+#include <unordered_set>
 
 using namespace ftxui;
-namespace fs = std::filesystem;
-
-static std::string format_bytes(size_t bytes) {
-    std::ostringstream oss;
-    if (bytes >= 1024ULL * 1024 * 1024) {
-        oss << std::fixed << std::setprecision(1)
-            << static_cast<double>(bytes) / (1024.0 * 1024.0 * 1024.0) << " GB";
-    } else if (bytes >= 1024ULL * 1024) {
-        oss << std::fixed << std::setprecision(1)
-            << static_cast<double>(bytes) / (1024.0 * 1024.0) << " MB";
-    } else if (bytes >= 1024) {
-        oss << std::fixed << std::setprecision(1)
-            << static_cast<double>(bytes) / 1024.0 << " KB";
-    } else {
-        oss << bytes << " B";
+using download_manager::utils::format_bytes;
+using download_manager::utils::format_time;
+
+static std::string priority_to_string(DownloadPriority p) {
+    switch (p) {
+        case PRIORITY_HIGH:   return "alta";
+        case PRIORITY_NORMAL: return "normal";
+        case PRIORITY_LOW:    return "baixa";
+        default:              return "normal";
     }
-    return oss.str();
-}
-
-static std::string format_time(double seconds) {
-    std::ostringstream oss;
-    oss << std::fixed << std::setprecision(1) << seconds << "s";
-    return oss.str();
 }
 
 static std::string status_to_string(DownloadStatus s) {
@@ -47,12 +32,15 @@ static std::string status_to_string(DownloadStatus s) {
         case RUNNING:  return "BAIXANDO";
         case FINISHED: return "CONCLUIDO";
         case FAILED:   return "FALHOU";
+        case PAUSED:   return "PAUSADO";
+        case CANCELLED: return "CANCELADO";
         default:       return "DESCONHECIDO";
     }
 }
 
-AppUI::AppUI(AppConfig config)
+AppUI::AppUI(AppConfig config, DownloadService& service)
     : config_(config)
+    , service_(service)
     , cfg_connections_(std::to_string(config.max_connections))
     , cfg_downloads_(std::to_string(config.max_downloads))
     , cfg_retries_(std::to_string(config.max_retries))
@@ -60,130 +48,77 @@ AppUI::AppUI(AppConfig config)
 {}
 
 void AppUI::submit_url() {
-    std::lock_guard lock(mutex_);
     if (url_input_.empty()) return;
 
-    auto entry = std::make_unique<DownloadEntry>();
-    entry->id = next_id_++;
-    entry->url = url_input_;
-    entry->output_dir = cfg_output_dir_.empty() ? "." : cfg_output_dir_;
-    entry->status = PENDING;
-    downloads_.push_back(std::move(entry));
-    selected_ = static_cast<int>(downloads_.size()) - 1;
+    service_.enqueue(url_input_, cfg_output_dir_.empty() ? "." : cfg_output_dir_);
+    service_.read([&](const DownloadService::Entries& entries) {
+        selected_ = static_cast<int>(entries.size()) - 1;
+    });
     url_input_.clear();
-
-    try_start_queued();
 }
 
-void AppUI::start_download(DownloadEntry* entry) {
-    auto callback = [this](int id, const DownloadEvent& event) {
-        on_download_event(id, event);
-    };
-
-    int entry_id = entry->id;
-    std::string url = entry->url;
-    std::string output_dir = entry->output_dir;
-    int max_connections = config_.max_connections;
-
-    spdlog::info("download enfileirado: id={} url={}", entry_id, url);
-
-    download_threads_.emplace_back([this, entry, entry_id, url, output_dir, max_connections, callback]() {
-        PreDownloadInfo info = PreDownloadInfo::check_info(url, false);
-
-        {
-            std::lock_guard lock(mutex_);
-            entry->filename = info.filename;
-            entry->content_size = info.content_size;
-            entry->accept_ranges = info.accept_ranges;
-            entry->output_path = (fs::path(output_dir) / info.filename).string();
-            entry->status = STARTED;
-        }
-
-        if (screen_) screen_->Post(Event::Custom);
-
-        // Pre-allocate file
-        {
-            std::ofstream file(entry->output_path, std::ios::binary);
-            if (!file.is_open()) {
-                spdlog::error("falha na pre-alocacao do arquivo: {}", entry->output_path);
-            }
-            if (info.content_size > 0) {
-                file.seekp(static_cast<std::streamoff>(info.content_size) - 1);
-                file.write("", 1);
-            }
-            file.close();
-        }
-
-        std::unique_ptr<DefaultDownloader> downloader;
-        if (DownloadManager::should_split(info.content_size, info.accept_ranges)) {
-            downloader = std::make_unique<ParalellDownloader>(max_connections);
-        } else {
-            downloader = std::make_unique<SingleDownloader>();
-        }
-
-        auto adapter = std::make_unique<DownloadObserverAdapter>(entry_id, callback);
-        downloader->add_observer(adapter.get());
-
-        DownloadOptions options{info.url, entry->output_path, info.content_size};
-        downloader->download(options);
-    });
+const DownloadEntry* AppUI::selected_entry(const DownloadService::Entries& entries) const {
+    if (selected_ < 0 || selected_ >= static_cast<int>(entries.size())) return nullptr;
+    return entries[selected_].get();
 }
 
-void AppUI::on_download_event(int download_id, const DownloadEvent& event) {
-    std::lock_guard lock(mutex_);
-
-    DownloadEntry* entry = nullptr;
-    for (auto& d : downloads_) {
-        if (d->id == download_id) {
-            entry = d.get();
-            break;
-        }
-    }
-    if (!entry) return;
-
-    if (event.thread_id >= 0) {
-        auto& ts = entry->threads[event.thread_id];
-        ts.status = event.status;
-        ts.bytes_downloaded = event.bytes_downloaded;
-        ts.total_bytes = event.total_bytes;
-        ts.elapsed_seconds = event.elapsed_seconds;
-    }
-
-    entry->status = event.status;
-    entry->elapsed_seconds = event.elapsed_seconds;
+const AppUI::Row& AppUI::refresh_row(const DownloadEntry& d) {
+    Row& row = rows_[d.id];
+    if (row.version == d.version) return row;
+    row.version = d.version;
 
-    size_t total_downloaded = 0;
-    for (const auto& [tid, ts] : entry->threads) {
-        total_downloaded += ts.bytes_downloaded;
+    std::string name = d.filename.empty() ? d.url : d.filename;
+    if (name.size() > 40) name = name.substr(0, 37) + "...";
+    if (d.status == PENDING && d.priority != PRIORITY_NORMAL) {
+        name = "[" + priority_to_string(d.priority) + "] " + name;
     }
-    entry->bytes_downloaded = total_downloaded;
+    row.label = " " + name;
 
-    if (event.status == FINISHED || event.status == FAILED) {
-        spdlog::debug("evento: id={} status={} thread={}", download_id,
-            event.status == FINISHED ? "FINISHED" : "FAILED", event.thread_id);
-        try_start_queued();
+    row.progress = 0.0f;
+    if (d.content_size > 0) {
+        row.progress = static_cast<float>(d.bytes_downloaded) /
+                       static_cast<float>(d.content_size);
     }
+    row.percent = " " + std::to_string(static_cast<int>(row.progress * 100)) + "% ";
+    return row;
+}
 
-    if (screen_) screen_->Post(Event::Custom);
+// Commands go through service_ after read() returns: the service lock is not
+// reentrant.
+void AppUI::change_priority(int delta) {
+    int id = -1;
+    DownloadPriority priority = PRIORITY_NORMAL;
+    service_.read([&](const DownloadService::Entries& entries) {
+        const DownloadEntry* d = selected_entry(entries);
+        if (!d || d->status != PENDING) return;
+        id = d->id;
+        int p = std::clamp(static_cast<int>(d->priority) + delta,
+                           static_cast<int>(PRIORITY_HIGH), static_cast<int>(PRIORITY_LOW));
+        priority = static_cast<DownloadPriority>(p);
+    });
+    if (id >= 0) service_.set_priority(id, priority);
 }
 
-void AppUI::try_start_queued() {
-    int active = 0;
-    for (const auto& d : downloads_) {
-        if (d->status == STARTED || d->status == RUNNING) {
-            active++;
-        }
-    }
+void AppUI::toggle_pause() {
+    int id = -1;
+    bool paused = false;
+    service_.read([&](const DownloadService::Entries& entries) {
+        const DownloadEntry* d = selected_entry(entries);
+        if (!d) return;
+        id = d->id;
+        paused = d->status == PAUSED || d->status == FAILED || d->status == CANCELLED;
+    });
+    if (id < 0) return;
+    if (paused) service_.resume(id);
+    else service_.pause(id);
+}
 
-    int max_dl = config_.max_downloads;
-    for (auto& d : downloads_) {
-        if (active >= max_dl) break;
-        if (d->status == PENDING) {
-            d->status = STARTED;
-            start_download(d.get());
-            active++;
-        }
-    }
+void AppUI::cancel_selected() {
+    int id = -1;
+    service_.read([&](const DownloadService::Entries& entries) {
+        if (const DownloadEntry* d = selected_entry(entries)) id = d->id;
+    });
+    if (id >= 0) service_.cancel(id);
 }
 
 void AppUI::save_config() {
@@ -198,20 +133,16 @@ void AppUI::save_config() {
     } catch (...) {}
     config_.output_dir = cfg_output_dir_.empty() ? "." : cfg_output_dir_;
     config_.save();
+    service_.apply_config(config_);
 }
 
 void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
     auto screen = ScreenInteractive::Fullscreen();
     screen_ = &screen;
+    service_.set_on_change([this] { screen_->Post(Event::Custom); });
 
     if (!initial_url.empty()) {
-        auto entry = std::make_unique<DownloadEntry>();
-        entry->id = next_id_++;
-        entry->url = initial_url;
-        entry->output_dir = output_dir;
-        entry->status = PENDING;
-        downloads_.push_back(std::move(entry));
-        try_start_queued();
+        service_.enqueue(initial_url, output_dir);
     }
 
     // --- Left panel: all inputs ---
@@ -288,32 +219,50 @@ void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
     });
 
     auto right_renderer = Renderer(right_panel, [&] {
-        std::lock_guard lock(mutex_);
+        // Each row takes two lines, so the list never shows more than half
+        // the screen's height worth of entries; only those are touched.
+        const int capacity = std::max(1, screen.dimy() / 2);
+        int total = 0;
+        std::vector<int> visible;
+        std::optional<DownloadEntry> sel;
+
+        // Only the visible window is read under the service lock
+        service_.read([&](const DownloadService::Entries& downloads) {
+            total = static_cast<int>(downloads.size());
+            if (selected_ < first_row_) first_row_ = selected_;
+            if (selected_ >= first_row_ + capacity) first_row_ = selected_ - capacity + 1;
+            first_row_ = std::clamp(first_row_, 0, std::max(0, total - capacity));
+
+            const int last = std::min(total, first_row_ + capacity);
+            visible.reserve(static_cast<size_t>(last - first_row_));
+            for (int i = first_row_; i < last; i++) {
+                refresh_row(*downloads[i]);
+                visible.push_back(downloads[i]->id);
+            }
+            if (selected_ >= 0 && selected_ < total) sel = *downloads[selected_];
+        });
 
-        Elements download_list;
-        for (int i = 0; i < static_cast<int>(downloads_.size()); i++) {
-            const auto& d = downloads_[i];
-            std::string name = d->filename.empty() ? d->url : d->filename;
-            if (name.size() > 40) name = name.substr(0, 37) + "...";
-
-            float progress = 0.0f;
-            if (d->content_size > 0) {
-                progress = static_cast<float>(d->bytes_downloaded) /
-                           static_cast<float>(d->content_size);
+        if (rows_.size() > visible.size() * 2) {
+            const std::unordered_set<int> keep(visible.begin(), visible.end());
+            for (auto it = rows_.begin(); it != rows_.end();) {
+                it = keep.count(it->first) ? std::next(it) : rows_.erase(it);
             }
-            int percent = static_cast<int>(progress * 100);
+        }
 
+        Elements download_list;
+        for (size_t k = 0; k < visible.size(); k++) {
+            const Row& row = rows_.at(visible[k]);
             auto item = vbox({
-                text(" " + name) | bold,
+                text(row.label) | bold,
                 hbox({
                     text(" "),
-                    gauge(progress) | flex,
-                    text(" " + std::to_string(percent) + "% "),
+                    gauge(row.progress) | flex,
+                    text(row.percent),
                 }),
             });
 
-            if (i == selected_) {
-                item = item | inverted;
+            if (first_row_ + static_cast<int>(k) == selected_) {
+                item = item | inverted | focus;
             }
             download_list.push_back(item);
         }
@@ -326,9 +275,7 @@ void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
 
         // Tab content for selected download
         Element tab_content;
-        if (selected_ >= 0 && selected_ < static_cast<int>(downloads_.size())) {
-            const auto& sel = downloads_[selected_];
-
+        if (sel) {
             if (detail_tab_ == 0) {
                 // Progress tab - per-thread gauges
                 Elements thread_rows;
@@ -346,12 +293,16 @@ void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
                         Color bar_color = Color::Blue;
                         if (ts.status == FINISHED) bar_color = Color::Green;
                         else if (ts.status == FAILED) bar_color = Color::Red;
+                        else if (ts.status == CANCELLED) bar_color = Color::GrayDark;
 
                         thread_rows.push_back(hbox({
                             text(" #" + std::to_string(tid)) | size(WIDTH, EQUAL, 5),
                             gauge(t_progress) | flex | color(bar_color),
                             text(" " + std::to_string(t_percent) + "%") | size(WIDTH, EQUAL, 5),
                             text(" " + format_bytes(ts.bytes_downloaded) + "/" + format_bytes(ts.total_bytes)),
+                            ts.retries > 0
+                                ? text(" tentativas: " + std::to_string(ts.retries)) | color(Color::Yellow)
+                                : text(""),
                         }));
                     }
                 }
@@ -365,6 +316,7 @@ void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
                     text(" tamanho:       " + format_bytes(sel->content_size)),
                     text(" accept_ranges: " + std::string(sel->accept_ranges ? "sim" : "nao")),
                     text(" status:        " + status_to_string(sel->status)),
+                    text(" prioridade:    " + priority_to_string(sel->priority)),
                     text(" tempo:         " + format_time(sel->elapsed_seconds)),
                     text(" baixado:       " + format_bytes(sel->bytes_downloaded)),
                 });
@@ -373,7 +325,12 @@ void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
             tab_content = text(" selecione um download") | dim;
         }
 
-        return window(text(" monitor "), vbox({
+        std::string title = " monitor ";
+        if (total > 0) {
+            title = " monitor " + std::to_string(selected_ + 1) + "/" + std::to_string(total) + " ";
+        }
+
+        return window(text(title), vbox({
             vbox(download_list) | vscroll_indicator | yframe | flex,
             separator(),
             hbox({text(" "), tab_toggle->Render()}),
@@ -394,7 +351,7 @@ void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
             right_renderer->Render() | flex,
         });
 
-        std::string status_text = " q: Sair | i: Editar | Up/Down: Navegar";
+        std::string status_text = " q: Sair | i: Editar | Up/Down: Navegar | +/-: Prioridade | p: Pausar | x: Cancelar";
         if (confirming_exit_) {
             status_text = " Download em andamento! Sair? (s/n)";
         } else if (editing_config_) {
@@ -412,15 +369,17 @@ void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
 
     auto component = CatchEvent(main_renderer, [&](Event event) {
         if (event == Event::Special("\x71")) { // Ctrl+Q
-            std::lock_guard lock(mutex_);
             bool has_active = false;
-            for (const auto& d : downloads_) {
-                if (d->status == STARTED || d->status == RUNNING || d->status == PENDING) {
-                    has_active = true;
-                    break;
+            service_.read([&](const DownloadService::Entries& entries) {
+                for (const auto& d : entries) {
+                    if (d->status == STARTED || d->status == RUNNING || d->status == PENDING) {
+                        has_active = true;
+                        break;
+                    }
                 }
-            }
-            if (!has_active) {
+            });
+            // A daemon keeps downloading after the client goes away
+            if (!has_active || service_.is_remote()) {
                 save_config();
                 screen.Exit();
                 return true;
@@ -450,14 +409,28 @@ void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
             }
         }
 
+        if (event == Event::Character('+') || event == Event::Character('-')) {
+            change_priority(event == Event::Character('+') ? -1 : 1);
+            return true;
+        }
+
+        if (event == Event::Character('p') || event == Event::Character('P')) {
+            toggle_pause();
+            return true;
+        }
+        if (event == Event::Character('x') || event == Event::Character('X')) {
+            cancel_selected();
+            return true;
+        }
+
         if (event == Event::ArrowUp) {
-            std::lock_guard lock(mutex_);
             if (selected_ > 0) selected_--;
             return true;
         }
         if (event == Event::ArrowDown) {
-            std::lock_guard lock(mutex_);
-            if (selected_ < static_cast<int>(downloads_.size()) - 1) selected_++;
+            service_.read([&](const DownloadService::Entries& entries) {
+                if (selected_ < static_cast<int>(entries.size()) - 1) selected_++;
+            });
             return true;
         }
 
@@ -465,9 +438,6 @@ void AppUI::run(const std::string& initial_url, const std::string& output_dir) {
     });
 
     screen.Loop(component);
+    service_.set_on_change(nullptr);
     screen_ = nullptr;
-
-    for (auto& t : download_threads_) {
-        if (t.joinable()) t.join();
-    }
 }
@@ -1,4 +1,7 @@
 #include "utils.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
 
 namespace download_manager::utils {
   std::vector<cpr::Range> split_ranges(size_t total, size_t parts) {
@@ -18,6 +21,10 @@ namespace download_manager::utils {
 	return ranges;
   }
 
+  bool should_split(size_t size, bool accept_ranges, size_t min_split_size) {
+	return accept_ranges && size >= min_split_size;
+  }
+
   std::string extract_filename_from_url(const std::string& url) {
 	std::string path = url;
 
@@ -56,4 +63,100 @@ namespace download_manager::utils {
 
 	return filename;
   }
+
+  // "host:port" of a URL, with the scheme's default port filled in, so
+  // downloads that share a server share its limits.
+  std::string extract_origin_from_url(const std::string& url) {
+	std::string scheme = "http";
+	std::string rest = url;
+
+	auto scheme_end = rest.find("://");
+	if (scheme_end != std::string::npos) {
+		scheme = rest.substr(0, scheme_end);
+		rest = rest.substr(scheme_end + 3);
+	}
+	std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+
+	auto authority_end = rest.find_first_of("/?#");
+	std::string authority = rest.substr(0, authority_end);
+
+	auto at = authority.rfind('@');
+	if (at != std::string::npos) authority = authority.substr(at + 1);
+
+	std::transform(authority.begin(), authority.end(), authority.begin(), ::tolower);
+
+	// IPv6 literals keep their brackets; only a colon after them is a port
+	auto bracket = authority.rfind(']');
+	auto colon = authority.rfind(':');
+	if (colon != std::string::npos && (bracket == std::string::npos || colon > bracket)) {
+		return authority;
+	}
+
+	return authority + ":" + (scheme == "https" ? "443" : "80");
+  }
+
+  // Results fit std::string's small buffer, so formatting never allocates
+  std::string format_bytes(size_t bytes) {
+	char buf[16];
+	if (bytes >= 1024ULL * 1024 * 1024) {
+		std::snprintf(buf, sizeof(buf), "%.1f GB", static_cast<double>(bytes) / (1024.0 * 1024.0 * 1024.0));
+	} else if (bytes >= 1024ULL * 1024) {
+		std::snprintf(buf, sizeof(buf), "%.1f MB", static_cast<double>(bytes) / (1024.0 * 1024.0));
+	} else if (bytes >= 1024) {
+		std::snprintf(buf, sizeof(buf), "%.1f KB", static_cast<double>(bytes) / 1024.0);
+	} else {
+		std::snprintf(buf, sizeof(buf), "%zu B", bytes);
+	}
+	return buf;
+  }
+
+  std::string format_time(double seconds) {
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%.1fs", seconds);
+	return buf;
+  }
+
+  long parse_status_line(std::string_view line) {
+	if (line.rfind("HTTP/", 0) != 0)
+		return 0;
+	const auto sp = line.find(' ');
+	if (sp == std::string_view::npos || sp + 4 > line.size())
+		return 0;
+	long code = 0;
+	for (size_t i = sp + 1; i < sp + 4; ++i) {
+		if (line[i] < '0' || line[i] > '9')
+			return 0;
+		code = code * 10 + (line[i] - '0');
+	}
+	return code;
+  }
+
+  bool parse_content_range(std::string_view line, size_t& first, size_t& last) {
+	constexpr std::string_view name = "content-range:";
+	if (line.size() < name.size())
+		return false;
+	for (size_t i = 0; i < name.size(); ++i) {
+		if (std::tolower(static_cast<unsigned char>(line[i])) != name[i])
+			return false;
+	}
+	line.remove_prefix(name.size());
+	while (!line.empty() && line.front() == ' ')
+		line.remove_prefix(1);
+	if (line.rfind("bytes ", 0) != 0)
+		return false;
+	line.remove_prefix(6);
+
+	auto number = [&](size_t& out) {
+		size_t i = 0;
+		out = 0;
+		while (i < line.size() && line[i] >= '0' && line[i] <= '9')
+			out = out * 10 + static_cast<size_t>(line[i++] - '0');
+		line.remove_prefix(i);
+		return i > 0;
+	};
+	if (!number(first) || line.empty() || line.front() != '-')
+		return false;
+	line.remove_prefix(1);
+	return number(last) && last >= first;
+  }
 }
@@ -0,0 +1,159 @@
+#include "write_back.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+#include <unistd.h>
+
+namespace {
+
+void drop_cached(int fd) {
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+    (void)fd;
+#endif
+}
+
+}
+
+SyncPolicy parse_sync_policy(const std::string &name) {
+    if (name == "none") return SyncPolicy::NONE;
+    if (name == "finish") return SyncPolicy::FINISH;
+    if (name != "batch") spdlog::warn("sync desconhecido '{}', usando batch", name);
+    return SyncPolicy::BATCH;
+}
+
+CacheMode parse_cache_mode(const std::string &name) {
+    if (name == "dontneed") return CacheMode::DONTNEED;
+    if (name == "direct") return CacheMode::DIRECT;
+    if (name != "normal") spdlog::warn("cache_mode desconhecido '{}', usando normal", name);
+    return CacheMode::NORMAL;
+}
+
+std::string part_path(const std::string &out) {
+    return out + ".part";
+}
+
+WriteBack::WriteBack(int fd, SyncPolicy policy, size_t batch, bool drop_cache)
+    : fd_(fd), policy_(policy), batch_(batch), drop_cache_(drop_cache) {}
+
+void WriteBack::wrote(size_t bytes) {
+    if ((policy_ != SyncPolicy::BATCH && !drop_cache_) || batch_ == 0) return;
+    if (pending_.fetch_add(bytes) + bytes < batch_) return;
+
+    std::unique_lock lock(flushing_, std::try_to_lock);
+    if (!lock.owns_lock()) return; // another writer is already on it
+    pending_ = 0;
+#ifdef __linux__
+    // Waits for the pages queued last time, then queues everything dirty
+    // now without waiting for it
+    sync_file_range(fd_, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE);
+#else
+    fsync(fd_);
+#endif
+    // Everything but the batch just queued is clean now; pages still under
+    // writeback are skipped by the kernel and caught next time
+    if (drop_cache_) drop_cached(fd_);
+}
+
+bool WriteBack::finish() {
+    bool ok = true;
+    if (policy_ != SyncPolicy::NONE) ok = fsync(fd_) == 0;
+    if (drop_cache_) {
+        // The tail is only clean once written back
+        if (policy_ == SyncPolicy::NONE) fsync(fd_);
+        drop_cached(fd_);
+    }
+    return ok;
+}
+
+DirectWriter::DirectWriter(int direct_fd, int buffered_fd)
+    : direct_fd_(direct_fd), buffered_fd_(buffered_fd),
+      buffer_(static_cast<char *>(std::aligned_alloc(BLOCK, STAGING))) {}
+
+DirectWriter::~DirectWriter() {
+    std::free(buffer_);
+}
+
+bool DirectWriter::write(const char *data, size_t size, size_t offset) {
+    if (!buffer_) return write_at(buffered_fd_, data, size, offset);
+    if (staged_ > 0 && offset != start_ + staged_ && !flush()) return false;
+
+    if (staged_ == 0) {
+        // A run starts at a block boundary; bytes before it are buffered
+        const size_t head = std::min(size, (BLOCK - offset % BLOCK) % BLOCK);
+        if (head > 0) {
+            if (!write_at(buffered_fd_, data, head, offset)) return false;
+            data += head;
+            size -= head;
+            offset += head;
+        }
+        start_ = offset;
+    }
+
+    while (size > 0) {
+        const size_t n = std::min(size, STAGING - staged_);
+        std::memcpy(buffer_ + staged_, data, n);
+        staged_ += n;
+        data += n;
+        size -= n;
+        if (staged_ == STAGING) {
+            if (!write_at(direct_fd_, buffer_, STAGING, start_)) return false;
+            start_ += STAGING;
+            staged_ = 0;
+        }
+    }
+    return true;
+}
+
+bool DirectWriter::flush() {
+    const size_t aligned = staged_ - staged_ % BLOCK;
+    bool ok = aligned == 0 || write_at(direct_fd_, buffer_, aligned, start_);
+    if (ok && staged_ > aligned) {
+        ok = write_at(buffered_fd_, buffer_ + aligned, staged_ - aligned, start_ + aligned);
+    }
+    start_ += staged_;
+    staged_ = 0;
+    return ok;
+}
+
+int open_direct(const std::string &path) {
+#ifdef O_DIRECT
+    return open(path.c_str(), O_WRONLY | O_DIRECT);
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+bool write_at(int fd, const char *data, size_t size, size_t offset) {
+    while (size > 0) {
+        const ssize_t n = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool publish(const std::string &part, const std::string &out, SyncPolicy policy) {
+    if (std::rename(part.c_str(), out.c_str()) != 0) return false;
+    if (policy == SyncPolicy::NONE) return true;
+
+    std::string dir = std::filesystem::path(out).parent_path().string();
+    if (dir.empty()) dir = ".";
+    const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return true; // the file itself is already durable
+    fsync(fd);
+    close(fd);
+    return true;
+}
@@ -0,0 +1,113 @@
+#include "config.h"
+#include "downloader.h"
+#include "engine.h"
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct EngineBench {
+    static void on_download_event(DownloadEngine &engine, int id, const DownloadEvent &event) {
+        engine.on_download_event(id, event);
+    }
+
+    // No admission at all: max_downloads = 0 alone still lends idle
+    // connections to one entry per origin, which would start a download
+    static void hold_queue(DownloadEngine &engine) {
+        DownloadScheduler::Limits limits;
+        limits.max_active = 0;
+        std::lock_guard lock(engine.mutex_);
+        engine.scheduler_.set_limits(limits);
+    }
+};
+
+namespace {
+
+// Stands in for a downloader whose monitor loop reports every segment each
+// tick, as ParalellDownloader does every 250 ms
+class ReplayDownloader : public DefaultDownloader {
+public:
+    void download(const DownloadOptions &) override {}
+};
+
+// With EngineBench::hold_queue, never admits or probes an entry, so nothing
+// touches the network and entries stay PENDING whatever the events say
+AppConfig idle_config() {
+    AppConfig config;
+    config.max_downloads = 0;
+    config.probe_concurrency = 0;
+    return config;
+}
+
+// One monitor tick of a parallel download: a RUNNING event per segment
+DownloadEvent segment_event(int segment, size_t done, size_t size) {
+    return {RUNNING, done, size, 12.5, segment, 0, 0, 0.08};
+}
+
+void BM_EmitDispatch(benchmark::State &state) {
+    const int observers = static_cast<int>(state.range(0));
+    ReplayDownloader downloader;
+    std::atomic<size_t> seen{0};
+    std::vector<std::unique_ptr<DownloadObserverAdapter>> adapters;
+    for (int i = 0; i < observers; ++i) {
+        adapters.push_back(std::make_unique<DownloadObserverAdapter>(
+            0, [&seen](int, const DownloadEvent &event) { seen += event.bytes_downloaded; }));
+        downloader.add_observer(adapters.back().get());
+    }
+
+    size_t done = 0;
+    for (auto _ : state) {
+        downloader.emit(segment_event(3, done++, 1 << 30));
+    }
+    benchmark::DoNotOptimize(seen.load());
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EmitDispatch)->Arg(1)->Arg(4);
+
+// emit -> adapter -> DownloadEngine::on_download_event, with `downloads`
+// entries in the queue and `segments` per download reporting each tick
+void BM_EmitToEngine(benchmark::State &state) {
+    const int downloads = static_cast<int>(state.range(0));
+    const int segments = static_cast<int>(state.range(1));
+
+    DownloadEngine engine(idle_config());
+    EngineBench::hold_queue(engine);
+    size_t changes = 0;
+    engine.set_on_change([&changes] { changes++; });
+    for (int i = 0; i < downloads; ++i) {
+        engine.enqueue("https://mirror.example.com/pool/file-" + std::to_string(i) + ".iso", "/tmp");
+    }
+
+    std::vector<std::unique_ptr<ReplayDownloader>> downloaders;
+    std::vector<std::unique_ptr<DownloadObserverAdapter>> adapters;
+    for (int id = 0; id < downloads; ++id) {
+        downloaders.push_back(std::make_unique<ReplayDownloader>());
+        adapters.push_back(std::make_unique<DownloadObserverAdapter>(
+            id, [&engine](int download_id, const DownloadEvent &event) {
+                EngineBench::on_download_event(engine, download_id, event);
+            }));
+        downloaders.back()->add_observer(adapters.back().get());
+    }
+
+    const size_t segment_size = 256ULL << 20;
+    size_t tick = 0;
+    for (auto _ : state) {
+        ReplayDownloader &downloader = *downloaders[tick % downloaders.size()];
+        for (int s = 0; s < segments; ++s) {
+            downloader.emit(segment_event(s, (tick * 4096) % segment_size, segment_size));
+        }
+        tick++;
+    }
+    bool admitted = false;
+    engine.read([&](const DownloadService::Entries &entries) {
+        for (const auto &entry : entries) admitted |= entry->status != PENDING;
+    });
+    if (admitted) state.SkipWithError("an entry left PENDING: a download really ran");
+    benchmark::DoNotOptimize(changes);
+    state.SetItemsProcessed(state.iterations() * segments);
+}
+BENCHMARK(BM_EmitToEngine)->ArgsProduct({{1, 50, 1000}, {1, 8, 32}});
+
+}
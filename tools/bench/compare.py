@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Compares two Google Benchmark JSON runs and fails on regressions.
+
+    ./bench --benchmark_repetitions=5 --benchmark_out=base.json --benchmark_out_format=json
+    (apply the change, rebuild)
+    ./bench --benchmark_repetitions=5 --benchmark_out=new.json --benchmark_out_format=json
+    tools/bench/compare.py base.json new.json --threshold 5
+
+With repetitions, the median of each benchmark is compared; otherwise the
+single run is. Exits 1 if any benchmark got slower by more than the
+threshold (percent), 2 if the runs share no benchmark.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path, metric):
+    with open(path) as f:
+        data = json.load(f)
+
+    runs = {}
+    medians = {}
+    for b in data.get("benchmarks", []):
+        if b.get("error_occurred"):
+            continue
+        if b.get("run_type") == "aggregate":
+            if b.get("aggregate_name") == "median":
+                medians[b["run_name"]] = b[metric]
+        else:
+            runs.setdefault(b.get("run_name", b["name"]), b[metric])
+    runs.update(medians)
+    return runs, data.get("context", {})
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed slowdown in percent (default 10)")
+    parser.add_argument("--metric", choices=["cpu_time", "real_time"], default="cpu_time")
+    parser.add_argument("--filter", default="", help="only benchmarks whose name contains this")
+    args = parser.parse_args()
+
+    base, base_ctx = load(args.baseline, args.metric)
+    cur, cur_ctx = load(args.current, args.metric)
+    if base_ctx.get("library_build_type") == "debug" or cur_ctx.get("library_build_type") == "debug":
+        print("aviso: Google Benchmark compilado em debug, tempos menos estaveis", file=sys.stderr)
+
+    names = [n for n in base if n in cur and args.filter in n]
+    if not names:
+        print("nenhum benchmark em comum", file=sys.stderr)
+        return 2
+
+    only_one = sorted(n for n in set(base) ^ set(cur) if args.filter in n)
+    width = max(len(n) for n in names + only_one)
+    print(f"{'benchmark':<{width}}  {'antes':>12}  {'depois':>12}  {'delta':>8}")
+    regressions = []
+    for name in names:
+        before, after = base[name], cur[name]
+        delta = (after - before) / before * 100.0 if before > 0 else 0.0
+        mark = ""
+        if delta > args.threshold:
+            mark = "  REGRESSAO"
+            regressions.append(name)
+        elif delta < -args.threshold:
+            mark = "  melhora"
+        print(f"{name:<{width}}  {before:>12.1f}  {after:>12.1f}  {delta:>+7.1f}%{mark}")
+
+    for name in only_one:
+        print(f"{name:<{width}}  {'so em ' + ('antes' if name in base else 'depois'):>12}")
+
+    if regressions:
+        print(f"\n{len(regressions)} regressao(oes) acima de {args.threshold:.1f}%", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,204 @@
+#include "netsim.h"
+#include <algorithm>
+#include <argparse/argparse.hpp>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Runs every strategy against the same randomly drawn scenarios and reports
+// completion-time distributions, e.g.
+//   netsim --scenarios 5000 --connections 1,4,8,16 --min-split 1M,5M,20M
+//   netsim --connections 8 --hedge 0,0.02,0.05 --slow-path 0.2
+
+namespace {
+
+size_t parse_size(const std::string &text) {
+    size_t pos = 0;
+    const double value = std::stod(text, &pos);
+    double scale = 1;
+    if (pos < text.size()) {
+        switch (text[pos]) {
+            case 'k': case 'K': scale = 1024.0; break;
+            case 'm': case 'M': scale = 1024.0 * 1024; break;
+            case 'g': case 'G': scale = 1024.0 * 1024 * 1024; break;
+            default: throw std::invalid_argument("tamanho invalido: " + text);
+        }
+    }
+    return static_cast<size_t>(value * scale);
+}
+
+template <typename T, typename Parse>
+std::vector<T> parse_list(const std::string &text, Parse parse) {
+    std::vector<T> out;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) out.push_back(parse(item));
+    }
+    return out;
+}
+
+double log_uniform(std::mt19937_64 &rng, double lo, double hi) {
+    return std::exp(std::uniform_real_distribution<double>(std::log(lo), std::log(hi))(rng));
+}
+
+netsim::Scenario draw(std::mt19937_64 &rng, int files, double max_failure_rate, double max_freeze_rate,
+                      double max_slow_path) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    netsim::Scenario s;
+    s.server.bandwidth = log_uniform(rng, 256.0 * 1024, 100.0 * 1024 * 1024);
+    s.server.rtt = log_uniform(rng, 0.005, 0.3);
+    s.server.ttfb = log_uniform(rng, 0.001, 0.2);
+    s.server.tls = unit(rng) < 0.8;
+    if (unit(rng) < 0.5) s.server.per_connection = log_uniform(rng, 64.0 * 1024, 10.0 * 1024 * 1024);
+    static constexpr int caps[] = {0, 0, 2, 4, 8, 16};
+    s.server.max_connections = caps[std::uniform_int_distribution<int>(0, 5)(rng)];
+    s.server.failure_rate = unit(rng) * max_failure_rate;
+    s.server.freeze_rate = unit(rng) * max_freeze_rate;
+    s.server.accept_ranges = unit(rng) < 0.9;
+    // Only drawn when asked for, so runs without it keep their scenarios
+    if (max_slow_path > 0) s.server.slow_path = unit(rng) * max_slow_path;
+    for (int i = 0; i < files; ++i) {
+        s.files.push_back(static_cast<size_t>(log_uniform(rng, 64.0 * 1024, 2.0 * 1024 * 1024 * 1024)));
+    }
+    s.seed = rng();
+    return s;
+}
+
+double percentile(std::vector<double> &values, double p) {
+    if (values.empty()) return 0.0;
+    const auto k = static_cast<size_t>(p * static_cast<double>(values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(k), values.end());
+    return values[k];
+}
+
+std::string format_size(size_t bytes) {
+    char buf[32];
+    if (bytes >= 1024 * 1024) std::snprintf(buf, sizeof(buf), "%.0fM", static_cast<double>(bytes) / (1024 * 1024));
+    else std::snprintf(buf, sizeof(buf), "%.0fK", static_cast<double>(bytes) / 1024);
+    return buf;
+}
+
+struct Totals {
+    std::vector<double> completion; // every finished file
+    std::vector<double> slowdown;   // makespan / best strategy's makespan, per scenario
+    int failed = 0;
+    long retries = 0;
+    long stalls = 0;
+    long hedges = 0;
+    double hedge_bytes = 0.0;
+    double bytes = 0.0; // of every file attempted
+    uint64_t events = 0;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("netsim");
+    program.add_argument("--scenarios").help("cenarios sorteados").default_value(1000).scan<'i', int>();
+    program.add_argument("--seed").help("semente do sorteio").default_value(1).scan<'i', int>();
+    program.add_argument("--files").help("arquivos por cenario").default_value(1).scan<'i', int>();
+    program.add_argument("--connections").help("max_connections a comparar").default_value(std::string("1,4,8,16"));
+    program.add_argument("--min-split").help("limiares de divisao a comparar").default_value(std::string("5M"));
+    program.add_argument("--hedge").help("orcamentos de hedge a comparar (fracao do arquivo, 0 = sem)").default_value(std::string("0.05"));
+    program.add_argument("--per-host").help("max_connections_per_host").default_value(8).scan<'i', int>();
+    program.add_argument("--max-downloads").help("downloads simultaneos").default_value(3).scan<'i', int>();
+    program.add_argument("--policy").help("fifo ou sef").default_value(std::string("fifo"));
+    program.add_argument("--retries").help("max_retries").default_value(3).scan<'i', int>();
+    program.add_argument("--failure-rate").help("resets por segundo (maximo sorteado)").default_value(0.01).scan<'g', double>();
+    program.add_argument("--freeze-rate").help("congelamentos por segundo (maximo sorteado)").default_value(0.005).scan<'g', double>();
+    program.add_argument("--slow-path").help("chance de uma conexao cair num caminho lento (maximo sorteado)").default_value(0.0).scan<'g', double>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::exception &err) {
+        std::cerr << err.what() << '\n' << program.help().str();
+        return 1;
+    }
+
+    std::vector<netsim::Strategy> strategies;
+    try {
+        const auto connections = parse_list<int>(program.get<std::string>("--connections"),
+                                                 [](const std::string &s) { return std::stoi(s); });
+        const auto thresholds = parse_list<size_t>(program.get<std::string>("--min-split"), parse_size);
+        const auto budgets = parse_list<double>(program.get<std::string>("--hedge"),
+                                                [](const std::string &s) { return std::stod(s); });
+        for (const size_t threshold : thresholds) {
+            for (const int n : connections) {
+                for (const double budget : budgets) {
+                    netsim::Strategy s;
+                    s.max_connections = std::max(1, n);
+                    s.min_split_size = threshold;
+                    s.max_retries = program.get<int>("--retries");
+                    s.max_connections_per_host = program.get<int>("--per-host");
+                    s.max_downloads = program.get<int>("--max-downloads");
+                    s.policy = program.get<std::string>("--policy") == "sef" ? SchedulingPolicy::SHORTEST_FIRST
+                                                                              : SchedulingPolicy::FIFO;
+                    s.hedge.budget = budget;
+                    strategies.push_back(s);
+                }
+            }
+        }
+    } catch (const std::exception &err) {
+        std::cerr << "lista invalida: " << err.what() << std::endl;
+        return 1;
+    }
+    if (strategies.empty()) return 1;
+
+    std::mt19937_64 rng(static_cast<uint64_t>(program.get<int>("--seed")));
+    const int scenarios = program.get<int>("--scenarios");
+    const int files = std::max(1, program.get<int>("--files"));
+    const double failure_rate = program.get<double>("--failure-rate");
+    const double freeze_rate = program.get<double>("--freeze-rate");
+    const double slow_path = program.get<double>("--slow-path");
+
+    std::vector<Totals> totals(strategies.size());
+    std::vector<double> makespans(strategies.size());
+    for (int n = 0; n < scenarios; ++n) {
+        const netsim::Scenario scenario = draw(rng, files, failure_rate, freeze_rate, slow_path);
+
+        double best = std::numeric_limits<double>::infinity();
+        for (size_t i = 0; i < strategies.size(); ++i) {
+            const netsim::Result r = netsim::simulate(scenario, strategies[i]);
+            Totals &t = totals[i];
+            for (const double c : r.completion) {
+                if (c >= 0) t.completion.push_back(c);
+            }
+            t.failed += r.failed;
+            t.retries += r.retries;
+            t.stalls += r.stalls;
+            t.hedges += r.hedges;
+            t.hedge_bytes += r.hedge_bytes;
+            for (const size_t size : scenario.files) t.bytes += static_cast<double>(size);
+            t.events += r.events;
+            makespans[i] = r.failed ? std::numeric_limits<double>::infinity() : r.makespan;
+            best = std::min(best, makespans[i]);
+        }
+        if (best == std::numeric_limits<double>::infinity() || best <= 0) continue;
+        for (size_t i = 0; i < strategies.size(); ++i) {
+            totals[i].slowdown.push_back(makespans[i] / best);
+        }
+    }
+
+    std::printf("%d cenarios x %d arquivo(s), seed %d\n\n", scenarios, files, program.get<int>("--seed"));
+    std::printf("%-6s %-6s %-6s %9s %9s %9s %9s %9s %9s %7s %8s %8s %8s %7s\n", "split", "conns", "hedge",
+                "mean(s)", "p50(s)", "p90(s)", "p99(s)", "slow p50", "slow p90", "failed", "retries", "stalls",
+                "hedges", "extra%");
+    for (size_t i = 0; i < strategies.size(); ++i) {
+        Totals &t = totals[i];
+        double mean = 0;
+        for (const double c : t.completion) mean += c;
+        if (!t.completion.empty()) mean /= static_cast<double>(t.completion.size());
+        std::printf("%-6s %-6d %-6.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %7d %8ld %8ld %8ld %7.2f\n",
+                    format_size(strategies[i].min_split_size).c_str(), strategies[i].max_connections,
+                    strategies[i].hedge.budget, mean, percentile(t.completion, 0.5), percentile(t.completion, 0.9),
+                    percentile(t.completion, 0.99), percentile(t.slowdown, 0.5), percentile(t.slowdown, 0.9), t.failed,
+                    t.retries, t.stalls, t.hedges, t.bytes > 0 ? 100.0 * t.hedge_bytes / t.bytes : 0.0);
+    }
+    return 0;
+}
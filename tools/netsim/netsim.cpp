@@ -0,0 +1,507 @@
+#include "netsim.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <random>
+#include <tuple>
+
+namespace netsim {
+
+namespace {
+
+constexpr double MSS = 1460.0;
+constexpr double INITIAL_WINDOW = 10 * MSS;
+// Downloads still running after a virtual day count as failed (hung)
+constexpr double HORIZON_SECONDS = 86400.0;
+// The monitor loop's tick, where ParalellDownloader launches hedges
+constexpr double HEDGE_TICK = 0.25;
+// A connection on a slow path gets at most this share of the bottleneck
+constexpr double SLOW_PATH_SHARE = 0.02;
+constexpr double INF = std::numeric_limits<double>::infinity();
+
+enum class EventType { PROBED, OPENED, GROW, DROP, FREEZE, MONITOR, HEDGE };
+
+struct Event {
+    double time;
+    uint64_t seq;
+    EventType type;
+    int target;          // download for PROBED/MONITOR/HEDGE, segment otherwise
+    uint64_t generation; // segment events are dropped once their connection is gone
+
+    bool operator>(const Event &other) const {
+        return std::tie(time, seq) > std::tie(other.time, other.seq);
+    }
+};
+
+// Mirrors the Segment worker in ParalellDownloader: it holds a budget slot
+// from the first attempt until it finishes or gives up, and re-issues its
+// remaining range on a new connection after every failure or stall.
+struct Segment {
+    int download;
+    size_t begin;
+    size_t end; // inclusive
+    double offset;
+    DownloadStatus status = STARTED;
+    int retries = 0;
+    int stalls = 0;
+    // The other side of a hedged race: the hedge on a segment, the segment on
+    // its hedge. Hedges are not in Download::segments and get one attempt.
+    int rival = -1;
+    bool hedge = false;
+    double finished_at = 0.0;
+
+    bool connected = false; // accepted by the server and transferring
+    bool frozen = false;
+    bool slow = false;      // on a slow path until it reconnects
+    double cwnd = INITIAL_WINDOW;
+    double rate = 0.0;
+    uint64_t generation = 0;
+    bool grow_pending = false;
+
+    // Owned by the monitor, as in ParalellDownloader::download
+    size_t window_start = 0;
+    int windows = 0;
+    int seen_retries = 0;
+    double hedge_mark = 0.0; // offset at the previous hedge tick
+    double recent_rate = 0.0;
+};
+
+struct Download {
+    size_t size;
+    bool split = false;
+    std::vector<int> segments;
+    int unfinished = 0;
+    bool failed = false;
+    double started = 0.0;
+    std::vector<int> hedges;
+};
+
+class Simulation {
+public:
+    Simulation(const Scenario &scenario, const Strategy &strategy)
+        : server_(scenario.server), strategy_(strategy), rng_(scenario.seed), hedge_rng_(scenario.seed + 1),
+          scheduler_(DownloadScheduler::Limits{strategy.max_downloads, 0, strategy.policy, {}}),
+          detector_(strategy.stall), planner_(strategy.hedge) {
+        result_.completion.assign(scenario.files.size(), -1.0);
+        for (const size_t size : scenario.files) {
+            const int id = static_cast<int>(downloads_.size());
+            downloads_.push_back(Download{size, false, {}, 0, false, 0.0, {}});
+            // Sizes are taken as known up front, as a metadata prober would
+            scheduler_.enqueue(id, "sim", PRIORITY_NORMAL, size);
+        }
+    }
+
+    Result run() {
+        admit();
+
+        while (true) {
+            int finishing = -1;
+            double next_completion = INF;
+            for (int i = 0; i < static_cast<int>(segments_.size()); ++i) {
+                const Segment &seg = segments_[i];
+                if (!seg.connected || seg.rate <= 0.0) continue;
+                const double t = now_ + (static_cast<double>(seg.end + 1) - seg.offset) / seg.rate;
+                if (t < next_completion) {
+                    next_completion = t;
+                    finishing = i;
+                }
+            }
+            const double next_event = events_.empty() ? INF : events_.top().time;
+            const double next = std::min(next_completion, next_event);
+            if (next == INF || next > HORIZON_SECONDS) break;
+
+            advance(next);
+            result_.events++;
+            if (next_completion <= next_event) {
+                segments_[finishing].offset = static_cast<double>(segments_[finishing].end + 1);
+                complete(finishing);
+            } else {
+                const Event event = events_.top();
+                events_.pop();
+                handle(event);
+            }
+            allocate();
+        }
+
+        for (const auto &seg : segments_) {
+            result_.retries += seg.retries;
+            result_.stalls += seg.stalls;
+            if (seg.hedge) {
+                result_.hedge_bytes += static_cast<double>(HedgePlanner::overlap(
+                    static_cast<size_t>(segments_[seg.rival].offset), seg.begin, static_cast<size_t>(seg.offset)));
+            }
+        }
+        for (const double t : result_.completion) {
+            if (t < 0) result_.failed++;
+            else result_.makespan = std::max(result_.makespan, t);
+        }
+        return result_;
+    }
+
+private:
+    ServerModel server_;
+    Strategy strategy_;
+    std::mt19937_64 rng_;
+    // Hedges draw their own luck, so the segments see the same network with
+    // and without hedging
+    std::mt19937_64 hedge_rng_;
+    DownloadScheduler scheduler_;
+    StallDetector detector_;
+    HedgePlanner planner_;
+
+    double now_ = 0.0;
+    uint64_t next_seq_ = 0;
+    std::priority_queue<Event, std::vector<Event>, std::greater<>> events_;
+    std::vector<Download> downloads_;
+    std::vector<Segment> segments_;
+
+    int budget_active_ = 0;
+    std::deque<int> budget_waiters_;
+    int server_open_ = 0;
+    int idle_connections_ = 0; // keep-alive connections in the shared curl cache
+
+    Result result_;
+
+    void schedule(double delay, EventType type, int target, uint64_t generation = 0) {
+        events_.push({now_ + delay, next_seq_++, type, target, generation});
+    }
+
+    double after(double rate, std::mt19937_64 &rng) {
+        if (rate <= 0.0) return INF;
+        return std::exponential_distribution<double>(rate)(rng);
+    }
+
+    // TCP handshake, TLS 1.3 handshake, then request and first byte; a
+    // reused keep-alive connection only pays the last round trip.
+    double open_delay() {
+        if (idle_connections_ > 0) {
+            idle_connections_--;
+            return server_.rtt + server_.ttfb;
+        }
+        return server_.rtt * (server_.tls ? 3.0 : 2.0) + server_.ttfb;
+    }
+
+    void admit() {
+        for (const int id : scheduler_.admit()) {
+            schedule(open_delay(), EventType::PROBED, id);
+        }
+    }
+
+    void advance(double t) {
+        const double dt = t - now_;
+        for (auto &seg : segments_) {
+            if (seg.connected) seg.offset = std::min(seg.offset + seg.rate * dt, static_cast<double>(seg.end + 1));
+        }
+        now_ = t;
+    }
+
+    // Max-min fair share of the bottleneck, each connection further capped
+    // by its congestion window and the per-connection limit
+    void allocate() {
+        std::vector<std::pair<double, int>> demands;
+        for (int i = 0; i < static_cast<int>(segments_.size()); ++i) {
+            Segment &seg = segments_[i];
+            seg.rate = 0.0;
+            if (!seg.connected || seg.frozen) continue;
+            double demand = seg.cwnd / server_.rtt;
+            if (server_.per_connection > 0) demand = std::min(demand, server_.per_connection);
+            if (seg.slow) demand = std::min(demand, server_.bandwidth * SLOW_PATH_SHARE);
+            demands.emplace_back(demand, i);
+        }
+        std::sort(demands.begin(), demands.end());
+
+        double left = server_.bandwidth;
+        for (size_t k = 0; k < demands.size(); ++k) {
+            const auto [demand, i] = demands[k];
+            Segment &seg = segments_[i];
+            seg.rate = std::min(demand, left / static_cast<double>(demands.size() - k));
+            left -= seg.rate;
+
+            // Slow start: the window doubles every round trip while it is
+            // what limits the connection
+            const bool window_bound = seg.cwnd / server_.rtt <= seg.rate * 1.0001;
+            if (window_bound && !seg.grow_pending) {
+                seg.grow_pending = true;
+                schedule(server_.rtt, EventType::GROW, i, seg.generation);
+            }
+        }
+    }
+
+    void handle(const Event &event) {
+        switch (event.type) {
+            case EventType::PROBED:
+                start_download(event.target);
+                return;
+            case EventType::MONITOR:
+                monitor(event.target);
+                return;
+            case EventType::HEDGE:
+                hedge(event.target);
+                return;
+            default:
+                break;
+        }
+
+        Segment &seg = segments_[event.target];
+        if (event.generation != seg.generation) return;
+        switch (event.type) {
+            case EventType::OPENED: {
+                if (server_.max_connections > 0 && server_open_ >= server_.max_connections) {
+                    attempt_failed(event.target, false);
+                    return;
+                }
+                server_open_++;
+                seg.connected = true;
+                seg.frozen = false;
+                seg.cwnd = INITIAL_WINDOW;
+                auto &rng = seg.hedge ? hedge_rng_ : rng_;
+                seg.slow = server_.slow_path > 0 &&
+                           std::uniform_real_distribution<double>(0.0, 1.0)(rng) < server_.slow_path;
+                if (const double t = after(server_.failure_rate, rng); t < INF) {
+                    schedule(t, EventType::DROP, event.target, seg.generation);
+                }
+                if (const double t = after(server_.freeze_rate, rng); t < INF) {
+                    schedule(t, EventType::FREEZE, event.target, seg.generation);
+                }
+                return;
+            }
+            case EventType::GROW:
+                seg.grow_pending = false;
+                if (seg.connected && seg.cwnd / server_.rtt <= seg.rate * 1.0001) {
+                    seg.cwnd = std::min(seg.cwnd * 2, server_.bandwidth * server_.rtt * 4);
+                }
+                return;
+            case EventType::DROP:
+                disconnect(seg);
+                attempt_failed(event.target, false);
+                return;
+            case EventType::FREEZE:
+                seg.frozen = true;
+                return;
+            default:
+                return;
+        }
+    }
+
+    void start_download(int id) {
+        Download &d = downloads_[id];
+        d.started = now_;
+        d.split = download_manager::utils::should_split(d.size, server_.accept_ranges, strategy_.min_split_size);
+
+        std::vector<std::pair<size_t, size_t>> ranges;
+        if (d.split) {
+            for (const auto &r : download_manager::utils::split_ranges(d.size, static_cast<size_t>(strategy_.max_connections))) {
+                ranges.emplace_back(static_cast<size_t>(r.resume_from), static_cast<size_t>(r.finish_at));
+            }
+        } else {
+            ranges.emplace_back(0, d.size - 1);
+        }
+
+        d.unfinished = static_cast<int>(ranges.size());
+        for (const auto &[begin, end] : ranges) {
+            const int index = static_cast<int>(segments_.size());
+            Segment seg{id, begin, end, static_cast<double>(begin)};
+            seg.window_start = begin;
+            seg.hedge_mark = static_cast<double>(begin);
+            segments_.push_back(seg);
+            d.segments.push_back(index);
+            request_slot(index);
+        }
+        if (d.split) schedule(strategy_.stall.window_seconds, EventType::MONITOR, id);
+        if (d.split && planner_.enabled()) schedule(HEDGE_TICK, EventType::HEDGE, id);
+    }
+
+    // ConnectionBudget: FIFO waiters once the per-origin cap is reached
+    void request_slot(int index) {
+        if (strategy_.max_connections_per_host > 0 && budget_active_ >= strategy_.max_connections_per_host) {
+            budget_waiters_.push_back(index);
+            return;
+        }
+        budget_active_++;
+        segments_[index].status = RUNNING;
+        connect(index);
+    }
+
+    void release_slot() {
+        budget_active_--;
+        if (!budget_waiters_.empty()) {
+            const int next = budget_waiters_.front();
+            budget_waiters_.pop_front();
+            request_slot(next);
+        }
+    }
+
+    void connect(int index) {
+        Segment &seg = segments_[index];
+        seg.generation++;
+        seg.grow_pending = false;
+        schedule(open_delay(), EventType::OPENED, index, seg.generation);
+    }
+
+    void disconnect(Segment &seg) {
+        if (seg.connected) server_open_--;
+        seg.connected = false;
+        seg.frozen = false;
+        seg.rate = 0.0;
+        seg.generation++;
+    }
+
+    void attempt_failed(int index, bool stalled) {
+        Segment &seg = segments_[index];
+        if (stalled) seg.stalls++;
+        if (seg.hedge) {
+            seg.status = FAILED;
+            release_slot();
+            hedge_lost(index);
+            return;
+        }
+        // SingleDownloader gives up on the first error
+        if (!downloads_[seg.download].split || ++seg.retries > strategy_.max_retries) {
+            seg.status = FAILED;
+            release_slot();
+            // A racing hedge may still complete the segment
+            if (seg.rival >= 0) return;
+            downloads_[seg.download].failed = true;
+            segment_done(seg.download);
+            return;
+        }
+        connect(index);
+    }
+
+    void complete(int index) {
+        Segment &seg = segments_[index];
+        disconnect(seg);
+        idle_connections_++;
+        seg.status = FINISHED;
+        release_slot();
+
+        const int primary = seg.hedge ? seg.rival : index;
+        if (seg.rival >= 0) abandon(seg.rival);
+        segments_[primary].status = FINISHED;
+        segments_[primary].finished_at = now_;
+        segment_done(segments_[primary].download);
+    }
+
+    // Stops the losing side of a race wherever it is: queued for a slot,
+    // connecting or transferring
+    void abandon(int index) {
+        Segment &seg = segments_[index];
+        if (seg.status == RUNNING) {
+            disconnect(seg);
+            release_slot();
+        } else if (seg.status == STARTED) {
+            budget_waiters_.erase(std::find(budget_waiters_.begin(), budget_waiters_.end(), index));
+        }
+        seg.status = CANCELLED;
+    }
+
+    // A hedge gave up or was dropped: its segment may be hedged again, and if
+    // it already gave up itself, so does the download
+    void hedge_lost(int index) {
+        Segment &primary = segments_[segments_[index].rival];
+        primary.rival = -1;
+        if (primary.status == FAILED) {
+            downloads_[primary.download].failed = true;
+            segment_done(primary.download);
+        }
+    }
+
+    void segment_done(int id) {
+        Download &d = downloads_[id];
+        if (--d.unfinished > 0) return;
+        if (!d.failed) result_.completion[id] = now_;
+        scheduler_.release(id);
+        admit();
+    }
+
+    // Same sampling as the monitor loop in ParalellDownloader::download
+    void monitor(int id) {
+        Download &d = downloads_[id];
+        if (d.unfinished == 0) return;
+
+        std::vector<SegmentSample> samples;
+        samples.reserve(d.segments.size());
+        for (const int index : d.segments) {
+            Segment &seg = segments_[index];
+            const auto offset = static_cast<size_t>(seg.offset);
+            const bool running = seg.status == RUNNING;
+            if (!running || seg.retries != seg.seen_retries) {
+                seg.seen_retries = seg.retries;
+                seg.windows = 0;
+            }
+            samples.push_back({offset - seg.window_start, seg.windows, running});
+            seg.window_start = offset;
+            if (running) seg.windows++;
+        }
+
+        for (const size_t i : detector_.stalled(samples)) {
+            const int index = d.segments[i];
+            disconnect(segments_[index]);
+            attempt_failed(index, true);
+        }
+
+        if (d.unfinished > 0) schedule(strategy_.stall.window_seconds, EventType::MONITOR, id);
+    }
+
+    // Same sampling and budget as the hedging in ParalellDownloader::download
+    void hedge(int id) {
+        Download &d = downloads_[id];
+        if (d.unfinished == 0) return;
+
+        size_t duplicated = 0;
+        for (const int index : d.hedges) {
+            const Segment &h = segments_[index];
+            duplicated += HedgePlanner::overlap(static_cast<size_t>(segments_[h.rival].offset), h.begin,
+                                                static_cast<size_t>(h.offset));
+        }
+        if (planner_.exhausted(duplicated, d.size)) {
+            for (const int index : d.hedges) {
+                if (segments_[index].status == RUNNING || segments_[index].status == STARTED) {
+                    abandon(index);
+                    hedge_lost(index);
+                }
+            }
+        }
+
+        std::vector<HedgeSample> samples;
+        samples.reserve(d.segments.size());
+        for (const int index : d.segments) {
+            Segment &seg = segments_[index];
+            const bool finished = seg.status == FINISHED;
+            seg.recent_rate = HedgePlanner::smooth(seg.recent_rate, (seg.offset - seg.hedge_mark) / HEDGE_TICK);
+            seg.hedge_mark = seg.offset;
+            const double running_for = (finished ? seg.finished_at : now_) - d.started;
+            samples.push_back({finished ? 0 : static_cast<size_t>(static_cast<double>(seg.end + 1) - seg.offset),
+                               seg.recent_rate, (seg.offset - static_cast<double>(seg.begin)) / running_for,
+                               seg.status == RUNNING, seg.rival >= 0});
+        }
+
+        for (const size_t i : planner_.pick(samples, d.size, duplicated)) {
+            const int primary = d.segments[i];
+            const int index = static_cast<int>(segments_.size());
+            Segment h{id, static_cast<size_t>(segments_[primary].offset), segments_[primary].end,
+                      segments_[primary].offset};
+            h.rival = primary;
+            h.hedge = true;
+            segments_.push_back(h);
+            segments_[primary].rival = index;
+            d.hedges.push_back(index);
+            result_.hedges++;
+            request_slot(index);
+        }
+
+        schedule(HEDGE_TICK, EventType::HEDGE, id);
+    }
+};
+
+} // namespace
+
+Result simulate(const Scenario &scenario, const Strategy &strategy) {
+    return Simulation(scenario, strategy).run();
+}
+
+}
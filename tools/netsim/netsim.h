@@ -0,0 +1,62 @@
+#ifndef CDOWNLOAD_MANAGER_NETSIM_H
+#define CDOWNLOAD_MANAGER_NETSIM_H
+
+#include "hedge_planner.h"
+#include "scheduler.h"
+#include "stall_detector.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Discrete-event model of the download path in virtual time. Bandwidth is a
+// fluid shared max-min fairly between transferring connections, so between
+// two events every rate is constant and completions can be solved exactly.
+namespace netsim {
+
+    struct ServerModel {
+        double bandwidth = 12.5e6;   // bytes/s through the shared bottleneck
+        double per_connection = 0.0; // bytes/s cap per connection, 0 = none
+        double rtt = 0.05;           // seconds
+        double ttfb = 0.02;          // server think time before the first byte
+        bool tls = true;             // one extra round trip per new connection
+        int max_connections = 0;     // connections beyond this are refused, 0 = none
+        double failure_rate = 0.0;   // connection resets per second of transfer
+        double freeze_rate = 0.0;    // per second: connection stops delivering but stays open
+        double slow_path = 0.0;      // chance a connection lands on a path capped at 2% of the bandwidth
+        bool accept_ranges = true;
+    };
+
+    struct Scenario {
+        ServerModel server;
+        std::vector<size_t> files; // all queued at t=0 on the same origin
+        uint64_t seed = 1;
+    };
+
+    // The knobs the real engine exposes through AppConfig
+    struct Strategy {
+        int max_connections = 8;            // segments per parallel download
+        size_t min_split_size = 5 * 1024 * 1024;
+        int max_retries = 3;
+        int max_connections_per_host = 8;   // ConnectionBudget cap
+        int max_downloads = 3;
+        SchedulingPolicy policy = SchedulingPolicy::FIFO;
+        StallPolicy stall;
+        HedgePolicy hedge;
+    };
+
+    struct Result {
+        std::vector<double> completion; // seconds from t=0, per file; < 0 when it failed
+        double makespan = 0.0;
+        int failed = 0;
+        int retries = 0;
+        int stalls = 0;
+        int hedges = 0;
+        double hedge_bytes = 0.0; // fetched by the losing side of a hedged race
+        uint64_t events = 0;
+    };
+
+    Result simulate(const Scenario &scenario, const Strategy &strategy);
+
+}
+
+#endif // CDOWNLOAD_MANAGER_NETSIM_H